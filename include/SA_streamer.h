@@ -35,19 +35,21 @@
 
 #include <string>
 
+// saidx_t is the type of the integers stored in the file (int or long).
+template<typename saidx_t = int>
 struct SA_streamer {
   SA_streamer(std::string fname) {
     f = fopen(fname.c_str(), "r");
     if (!f) { perror(fname.c_str()); exit(1); }
-    buf = new int[bufsize + 10];
+    buf = new saidx_t[bufsize + 10];
     pos = 0;
-    left = fread(buf, sizeof(int), bufsize, f);
+    left = fread(buf, sizeof(saidx_t), bufsize, f);
   }
   
-  inline int read() {
+  inline saidx_t read() {
     if (!left) {
       pos = 0;
-      left = fread(buf, sizeof(int), bufsize, f);
+      left = fread(buf, sizeof(saidx_t), bufsize, f);
     }
     --left;
     return buf[pos++];
@@ -59,7 +61,8 @@ struct SA_streamer {
   }
 
   static const int bufsize = 1 << 15;
-  int *buf, left, pos;
+  saidx_t *buf;
+  int left, pos;
 
   FILE *f;
 };
@@ -30,11 +30,20 @@
 #include <ctime>
 
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
 
+#include <string>
+#include <vector>
 #include <iostream>
-#include <fstream>
+#include <algorithm>
 
 #include "common.h"
+#include "divsufsort.h"
+#include "metrics.h"
 
 double elapsed(std::clock_t timestamp) {
   return ((double)std::clock() - timestamp) / CLOCKS_PER_SEC;
@@ -50,54 +59,187 @@ long double welapsed(long double ts) {
   return wclock() - ts;
 }
 
-void read_text(const char *filename, unsigned char* &text, int &length) {
-  std::fstream f(filename, std::fstream::in);
-  if (f.fail()) {
+// Maps the whole file read-only and applies the given madvise() advice.
+// Returns NULL for an empty file.
+static void *map_file(const char *filename, long &size, int advice) {
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1) {
     std::cerr << "\nError: cannot open file " << filename << "\n";
     std::exit(EXIT_FAILURE);
   }
+  struct stat st;
+  if (fstat(fd, &st)) {
+    std::cerr << "\nError: cannot stat file " << filename << "\n";
+    std::exit(EXIT_FAILURE);
+  }
+  size = st.st_size;
+  void *addr = NULL;
+  if (size > 0) {
+    addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      std::cerr << "\nError: mapping of " << size << " bytes from file "
+        << filename << " failed\n";
+      std::exit(EXIT_FAILURE);
+    }
+    madvise(addr, size, advice);
+  }
+  close(fd);
+  return addr;
+}
 
-  f.seekg(0, std::ios_base::end);
-  length = f.tellg();
-  f.seekg (0, std::ios_base::beg);
+void map_text(const char *filename, unsigned char* &text, long &length) {
+  LOG_INFO("Mapping the file " << filename << "... ");
+  // Parsing and suffix sorting access the text randomly, so ask for all of
+  // it to be paged in up front.
+  text = (unsigned char *)map_file(filename, length, MADV_WILLNEED);
+  LOG_INFO(length << " bytes" << std::endl);
+}
 
-  text = new unsigned char[length];
-  if (!text) {
-    std::cerr << "\nError: allocation of " << length << " bytes failed\n";
+// Reads the files of directory dirname (in name order), skipping hidden
+// ones, into a single anonymous mapping, without materializing the
+// concatenation on disk.
+static void read_collection(const char *dirname, unsigned char* &text,
+    long &length, std::vector<long> &file_starts) {
+  DIR *dir = opendir(dirname);
+  if (!dir) {
+    std::cerr << "\nError: cannot open directory " << dirname << "\n";
     std::exit(EXIT_FAILURE);
   }
+  std::vector<std::string> files;
+  for (dirent *entry; (entry = readdir(dir)); ) {
+    if (entry->d_name[0] == '.') continue;
+    std::string fname = input_name(dirname) + "/" + entry->d_name;
+    struct stat st;
+    if (!stat(fname.c_str(), &st) && S_ISREG(st.st_mode))
+      files.push_back(fname);
+  }
+  closedir(dir);
+  std::sort(files.begin(), files.end());
 
-  std::cerr << "Reading the file " << filename << " (" << length << " bytes)... ";
-  f.read((char *)text, length);
-  if (!f) {
-    std::cerr << "\nError: failed to read " << length << " bytes from file "
-      << filename << ". Only " << f.gcount() << " could be read\n";
-    std::exit(EXIT_FAILURE);
+  file_starts.assign(1, 0);
+  for (size_t f = 0; f < files.size(); ++f) {
+    struct stat st;
+    stat(files[f].c_str(), &st);
+    file_starts.push_back(file_starts.back() + st.st_size + 1);
   }
-  std::cerr << std::endl;
-  f.close();
+  length = file_starts.back();
+
+  LOG_INFO("Reading the collection " << dirname << " (" << files.size()
+    << " files, " << length << " bytes)... ");
+  text = NULL;
+  if (length > 0) {
+    text = (unsigned char *)mmap(NULL, length, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (text == MAP_FAILED) {
+      std::cerr << "\nError: allocation of " << length << " bytes failed\n";
+      std::exit(EXIT_FAILURE);
+    }
+  }
+  for (size_t f = 0; f < files.size(); ++f) {
+    long pos = file_starts[f], end = file_starts[f + 1] - 1;
+    int fd = open(files[f].c_str(), O_RDONLY);
+    while (fd != -1 && pos < end) {
+      ssize_t got = read(fd, text + pos, end - pos);
+      if (got <= 0) break;
+      pos += got;
+    }
+    if (fd == -1 || pos != end) {
+      std::cerr << "\nError: failed to read file " << files[f] << "\n";
+      std::exit(EXIT_FAILURE);
+    }
+    close(fd);
+    text[end] = COLLECTION_SEPARATOR;
+  }
+  LOG_INFO(std::endl);
 }
 
-void read_sa(const char *filename, int* &sa, int length) {
-  std::string fname = std::string(filename) + ".sa";
-  sa = new int[length + 2];
-  if (!sa) {
-    std::cerr << "\nError: allocation of " << length << " words failed\n";
-    std::exit(EXIT_FAILURE);
+void map_input(const char *path, unsigned char* &text, long &length,
+    std::vector<long> &file_starts) {
+  struct stat st;
+  if (!stat(path, &st) && S_ISDIR(st.st_mode)) {
+    read_collection(path, text, length, file_starts);
+  } else {
+    map_text(path, text, length);
+    file_starts.clear();
+    file_starts.push_back(0);
+    file_starts.push_back(length + 1);
   }
-  std::fstream f(fname.c_str(), std::fstream::in);
-  if (f.fail()) {
-    std::cerr << "\nError: cannot open file " << fname << "\n";
+}
+
+void unmap_file(const void *addr, long bytes) {
+  if (addr) munmap(const_cast<void *>(addr), bytes);
+}
+
+int construct_sa(const unsigned char *text, int *sa, long length) {
+  return divsufsort(text, sa, length);
+}
+
+int construct_sa(const unsigned char *text, long *sa, long length) {
+  return divsufsort64(text, sa, length);
+}
+
+std::string input_name(const char *path) {
+  std::string name(path);
+  while (name.size() > 1 && name.back() == '/') name.pop_back();
+  return name;
+}
+
+int sa_width(const char *filename, long length) {
+  std::string fname = input_name(filename) + ".sa";
+  struct stat st;
+  if (stat(fname.c_str(), &st)) return 0;
+  if (st.st_size == (off_t)sizeof(int) * length) return sizeof(int);
+  if (st.st_size == (off_t)sizeof(long) * length) return sizeof(long);
+  std::cerr << "\nError: size of " << fname << " (" << st.st_size
+    << " bytes) does not match a suffix array of " << length << " elements\n";
+  std::exit(EXIT_FAILURE);
+}
+
+template<typename saidx_t>
+void map_sa(const char *filename, saidx_t* &sa, long length) {
+  std::string fname = input_name(filename) + ".sa";
+  LOG_INFO("Mapping the suffix array... ");
+  // kkp2 makes a single left-to-right pass over the suffix array.
+  long size;
+  sa = (saidx_t *)map_file(fname.c_str(), size, MADV_SEQUENTIAL);
+  if (size != (long)sizeof(saidx_t) * length) {
+    std::cerr << "\nError: expected " << sizeof(saidx_t) * length
+      << " bytes in file " << fname << ", found " << size << "\n";
     std::exit(EXIT_FAILURE);
   }
-  std::cerr << "Reading the suffix array... ";
-  f.read((char *)sa, sizeof(int) * length);
-  if (!f) {
-    std::cerr << "\nError: failed to read " << sizeof(int) * length
-      << " bytes from file " << fname << ". Only " << f.gcount()
-      << " could be read\n";
-    std::exit(EXIT_FAILURE);
+  LOG_INFO(std::endl);
+}
+
+template void map_sa<int>(const char *, int* &, long);
+template void map_sa<long>(const char *, long* &, long);
+
+void generate_text(std::mt19937_64 &rng, unsigned char *text, long n,
+    long seed_len, long phrase_len, std::vector<long> *starts,
+    std::vector<long> *sources) {
+  long seed = std::min(n, seed_len);
+  for (long i = 0; i < seed; ++i) text[i] = "ACGT"[rng() & 3];
+  for (long i = seed; i < n; ) {
+    long src = rng() % i, len = 1 + rng() % (2 * phrase_len);
+    if (starts) starts->push_back(i);
+    if (sources) sources->push_back(src);
+    for (long j = 0; j < len && i < n; ++j) text[i++] = text[src + j];
+    if (i < n) text[i++] = "ACGT"[rng() & 3];
+  }
+}
+
+bool parse_sizes(const char *arg, std::vector<size_t> &sizes) {
+  while (*arg) {
+    char *end;
+    size_t size = strtoul(arg, &end, 10);
+    if (end == arg) return false;
+    switch (*end) {
+      case 'G': case 'g': size <<= 10; // fall through
+      case 'M': case 'm': size <<= 10; // fall through
+      case 'K': case 'k': size <<= 10; end++;
+    }
+    if (size == 0 || (*end && *end != ',')) return false;
+    sizes.push_back(size);
+    arg = *end ? end + 1 : end;
   }
-  std::cerr << std::endl;
-  f.close();
+  return true;
 }
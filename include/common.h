@@ -30,12 +30,74 @@
 #define __COMMON_H
 
 #include <ctime>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <random>
+
+// Texts of at least this length get a suffix array with 64-bit entries,
+// shorter ones keep the compact 32-bit layout.
+#ifndef SA64_THRESHOLD
+#define SA64_THRESHOLD 0x7fffffffL
+#endif
 
 double elapsed(std::clock_t timestamp);
 long double wclock();
 long double welapsed(long double ts);
 
-void read_text(const char *filename, unsigned char* &text, int &length);
-void read_sa(const char *filename, int* &sa, int length);
+// Memory-maps filename read-only into text. The mapping must be released
+// with unmap_file(text, length).
+void map_text(const char *filename, unsigned char* &text, long &length);
+
+// Computes the suffix array of text[0..length-1] with divsufsort, using
+// 32- or 64-bit entries. Returns 0 on success.
+int construct_sa(const unsigned char *text, int *sa, long length);
+int construct_sa(const unsigned char *text, long *sa, long length);
+
+// Fills text[0..n-1] with symbols over ACGT drawn from rng: seed_len random
+// symbols (all n if seed_len >= n), then edited copies of earlier text, each
+// of 1 to 2 * phrase_len symbols and followed by one random symbol. If
+// starts and sources are not NULL, they receive the start of every copy
+// and the start of its source. Used to generate benchmark inputs.
+void generate_text(std::mt19937_64 &rng, unsigned char *text, long n,
+    long seed_len, long phrase_len, std::vector<long> *starts = NULL,
+    std::vector<long> *sources = NULL);
+
+// Byte placed after every file of a collection. Files may contain it too,
+// e.g. binary ones, so it does not mark file ends by itself: use
+// file_starts.
+#define COLLECTION_SEPARATOR '\0'
+
+// Loads path into text: a single file is mapped as by map_text, while a
+// directory is read as a collection, i.e. the concatenation of its regular
+// files in name order, except the hidden ones (named .*), each followed by COLLECTION_SEPARATOR, into an
+// anonymous mapping. File f then occupies [file_starts[f],
+// file_starts[f + 1] - 1) and is followed by a separator. A single file is
+// described by file_starts = {0, length + 1}. Release with
+// unmap_file(text, length).
+void map_input(const char *path, unsigned char* &text, long &length,
+    std::vector<long> &file_starts);
+
+// Returns path without its trailing slashes, so that the files named after
+// a collection directory, such as its .sa, lie next to it and not inside
+// it, where map_input would read them as part of the collection.
+std::string input_name(const char *path);
+
+// Returns the size in bytes (4 or 8) of the entries of the suffix array
+// stored in filename.sa, deduced from the file size, or 0 if there is no
+// such file.
+int sa_width(const char *filename, long length);
+
+// Memory-maps the suffix array stored in filename.sa. saidx_t is int or
+// long and must match sa_width(). Release with
+// unmap_file(sa, length * sizeof(saidx_t)).
+template<typename saidx_t>
+void map_sa(const char *filename, saidx_t* &sa, long length);
+
+void unmap_file(const void *addr, long bytes);
+
+// Parses a comma-separated list of sizes, each with an optional K, M or G
+// (binary) suffix, appending them to sizes. Returns false on bad input.
+bool parse_sizes(const char *arg, std::vector<size_t> &sizes);
 
 #endif // __COMMON_H
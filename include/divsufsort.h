@@ -27,11 +27,17 @@
 #ifndef _DIVSUFSORT_H
 #define _DIVSUFSORT_H 1
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
 
 
+/*- Datatypes -*/
+typedef int64_t saidx64_t;
+
+
 /*- Prototypes -*/
 
 /**
@@ -55,6 +61,16 @@ divsufsort(const unsigned char *T, int *SA, int n);
 int
 divbwt(const unsigned char *T, unsigned char *U, int *A, int n);
 
+/**
+ * 64-bit versions of the above, for strings of length 2^31 or more.
+ * Built from the same source by divsufsort64.c.
+ */
+int
+divsufsort64(const unsigned char *T, saidx64_t *SA, saidx64_t n);
+
+saidx64_t
+divbwt64(const unsigned char *T, unsigned char *U, saidx64_t *A, saidx64_t n);
+
 
 #ifdef __cplusplus
 } /* extern "C" */
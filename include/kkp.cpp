@@ -35,28 +35,52 @@
 #include <algorithm>
 
 #include "kkp.h"
+#include "match.h"
 #include "SA_streamer.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #define STACK_BITS 16
 #define STACK_SIZE (1 << STACK_BITS)
 #define STACK_HALF (1 << (STACK_BITS - 1))
 #define STACK_MASK ((STACK_SIZE) - 1)
 
 // An auxiliary routine used during parsing.
-int parse_phrase(unsigned char *X, int n, int i, int psv, int nsv,
-    std::vector<std::pair<int, int> > *F, std::vector<std::pair<size_t,size_t>>& reference_counters);
+template<typename saidx_t>
+saidx_t parse_phrase(unsigned char *X, saidx_t n, saidx_t i, saidx_t psv, saidx_t nsv,
+    std::vector<std::pair<saidx_t, saidx_t> > *F, std::vector<ref_count_t<saidx_t> >& reference_counters);
+
+// Appends the phrase (pos, len) starting at i to F and to the counters, and
+// returns the start of the next phrase.
+template<typename saidx_t>
+saidx_t record_phrase(unsigned char *X, saidx_t n, saidx_t i, saidx_t pos, saidx_t len,
+    std::vector<std::pair<saidx_t, saidx_t> > *F, std::vector<ref_count_t<saidx_t> >& reference_counters);
 
-int kkp2(unsigned char *X, int *SA, int n,
-    std::vector<std::pair<int, int> > *F, std::vector<std::pair<size_t,size_t>>& reference_counters) {
+// Reads the suffix array sequentially from memory, with the same
+// interface as SA_streamer.
+template<typename saidx_t>
+struct SA_reader {
+  SA_reader(saidx_t *SA) : sa(SA) {}
+  inline saidx_t read() { return *sa++; }
+  saidx_t *sa;
+};
+
+// Common body of kkp1 and kkp2. The suffix array is only needed for the
+// PSV computation and is read once from left to right through reader.
+template<typename saidx_t, typename reader_t>
+long kkp(unsigned char *X, reader_t &reader, long n,
+    std::vector<std::pair<saidx_t, saidx_t> > *F, std::vector<ref_count_t<saidx_t> >& reference_counters) {
   if (n == 0) return 0;
-  int *CS = new int[n + 5];
-  int *stack = new int[STACK_SIZE + 5], top = 0;
+  saidx_t *CS = new saidx_t[n + 5];
+  saidx_t *stack = new saidx_t[STACK_SIZE + 5], top = 0;
   stack[top] = 0;
 
   // Compute PSV_text for SA and save into CS.
   CS[0] = -1;
-  for (int i = 1; i <= n; ++i) {
-    int sai = SA[i - 1] + 1;
+  for (saidx_t i = 1; i <= n; ++i) {
+    saidx_t sai = reader.read() + 1;
     while (stack[top] > sai) --top;
     if ((top & STACK_MASK) == 0) {
       if (stack[top] < 0) {
@@ -68,15 +92,15 @@ int kkp2(unsigned char *X, int *SA, int n,
         top = 1;
       } else if (top == STACK_SIZE) {
         // Stack is full -- discard half.
-        for (int j = STACK_HALF; j <= STACK_SIZE; ++j)
+        for (saidx_t j = STACK_HALF; j <= STACK_SIZE; ++j)
           stack[j - STACK_HALF] = stack[j];
         stack[0] = -stack[0];
         top = STACK_HALF;
       }
     }
 
-    int addr = sai;
-    CS[addr] = std::max(0, stack[top]);
+    saidx_t addr = sai;
+    CS[addr] = std::max((saidx_t)0, stack[top]);
     ++top;
     stack[top] = sai;
   }
@@ -84,90 +108,236 @@ int kkp2(unsigned char *X, int *SA, int n,
 
   // Compute the phrases.
   CS[0] = 0;
-  int nfactors = 0, next = 1, nsv, psv;
-  for (int t = 1; t <= n; ++t) {
+  long nfactors = 0;
+  saidx_t next = 1, nsv, psv;
+  for (saidx_t t = 1; t <= n; ++t) {
     psv = CS[t];
     nsv = CS[psv];
     if (t == next) {
-      next = parse_phrase(X, n, t - 1, psv - 1, nsv - 1, F, reference_counters) + 1;
+      next = parse_phrase<saidx_t>(X, n, t - 1, psv - 1, nsv - 1, F, reference_counters) + 1;
       ++nfactors;
     }
     CS[t] = nsv;
     CS[psv] = t;
   }
 
+  // Prefix sums of the +1/-1 marks give the number of phrases copying from
+  // each position. Counters wrap around modulo 2^32 (2^64), which is exact
+  // since no count can reach it (see ref_count_t).
+  for (long j = 1; j < n; ++j)
+    reference_counters[j] += reference_counters[j - 1];
+
   // Clean up.
   delete[] CS;
   return nfactors;
 }
 
-int parse_phrase(unsigned char *X, int n, int i, int psv, int nsv,
-                 std::vector<std::pair<int, int>> *F, std::vector<std::pair<size_t,size_t>>& reference_counters)
+template<typename saidx_t>
+long kkp1(unsigned char *X, std::string SA_fname, long n,
+    std::vector<std::pair<saidx_t, saidx_t> > *F, std::vector<ref_count_t<saidx_t> >& reference_counters) {
+  if (n == 0) return 0;
+  SA_streamer<saidx_t> reader(SA_fname);
+  return kkp<saidx_t>(X, reader, n, F, reference_counters);
+}
+
+// Computes into V[1..n], for every A[i] = SA[i] + 1 (SA[n - 1 - i] + 1 if
+// backward), the nearest A[j] with j < i and A[j] < A[i], or 0 if there is
+// none. With backward = false this is PSV_text of kkp, with backward = true
+// it is NSV_text.
+//
+// The SA is split into blocks that are processed in parallel. Instead of a
+// stack, which grows to the whole block where the values increase (e.g.
+// backwards through a run of one symbol), each entry walks the chain of
+// smaller values already stored in V, starting from the previous entry of
+// its block, so no memory beyond V is needed. A walk ends at the first
+// value below the entry, which skips every chain entry it passes for good,
+// so a block takes time linear in its length. Entries with no smaller
+// value earlier in their block are the prefix minima of the block. They
+// are linked through V (as -next - 1, -1 ending the list), which also ends
+// the walks at the block start, and resolved in a sequential merge that
+// walks the PSV chain of the previous blocks. Every entry is skipped at
+// most once by these walks, as each block's minimum shadows what its walks
+// skipped.
+template<typename saidx_t>
+void parallel_ansv(const saidx_t *SA, long n, saidx_t *V, bool backward,
+    long nblocks) {
+  long block_size = (n + nblocks - 1) / nblocks;
+  #pragma omp parallel for schedule(static)
+  for (long b = 0; b < nblocks; ++b) {
+    long beg = b * block_size, end = std::min(n, beg + block_size);
+    saidx_t prev = 0, last_min = 0;
+    for (long i = beg; i < end; ++i) {
+      saidx_t a = SA[backward ? n - 1 - i : i] + 1;
+      saidx_t c = prev;
+      while (c > a && V[c] >= 0) c = V[c];
+      if (c == 0 || c > a) {
+        if (last_min) V[last_min] = -a - 1;
+        V[a] = -1;
+        last_min = a;
+      } else V[a] = c;
+      prev = a;
+    }
+  }
+
+  // Merge: resolve the prefix minima of each block, in order.
+  for (long b = 0; b < nblocks; ++b) {
+    long beg = b * block_size;
+    if (beg >= n) break;
+    saidx_t c = beg ? SA[backward ? n - beg : beg - 1] + 1 : 0;
+    saidx_t u = SA[backward ? n - 1 - beg : beg] + 1;
+    for (;;) {
+      saidx_t next = V[u];
+      while (c > u) c = V[c];
+      V[u] = c;
+      if (next == -1) break;
+      u = -next - 1;
+    }
+  }
+}
+
+// Replaces PSV[t], NSV[t] by the phrase (pos, len) that parse_phrase would
+// choose at text position t - 1, for every t in [1, n], in parallel blocks.
+// If the suffix at i shares l symbols with its PSV (NSV) j, the suffix at
+// i + 1 shares at least l - 1 with its own PSV (NSV), since the suffix j + 1
+// lies between the two in SA. So, as in Kasai's LCP algorithm, each block
+// does O(block length + l) symbol comparisons per side, where l is the
+// longest match it finds. That is up to n: on repetitive input the first
+// match of a block alone can cost O(n), and all blocks together
+// O(n * nblocks).
+template<typename saidx_t>
+void parallel_lpf(unsigned char *X, long n, saidx_t *PSV, saidx_t *NSV, long nblocks) {
+  long block_size = (n + nblocks - 1) / nblocks;
+  #pragma omp parallel for schedule(static)
+  for (long b = 0; b < nblocks; ++b) {
+    long beg = b * block_size, end = std::min(n, beg + block_size);
+    saidx_t plen = 0, nlen = 0;
+    for (long i = beg; i < end; ++i) {
+      saidx_t psv = PSV[i + 1] - 1, nsv = NSV[i + 1] - 1;
+      plen = std::max((saidx_t)0, plen - 1);
+      nlen = std::max((saidx_t)0, nlen - 1);
+      plen = (psv == -1) ? 0 : match_length(X + psv, X + i, plen, n - i);
+      nlen = (nsv == -1) ? 0 : match_length(X + nsv, X + i, nlen, n - i);
+
+      // Ties go to nsv, as in parse_phrase.
+      if (nsv == -1 || plen > nlen) {
+        PSV[i + 1] = psv;
+        NSV[i + 1] = plen;
+      } else {
+        PSV[i + 1] = nsv;
+        NSV[i + 1] = nlen;
+      }
+    }
+  }
+}
+
+// Parallel version of kkp2: PSV_text and NSV_text are computed for all
+// positions up front with parallel_ansv, which leaves only the (cheap)
+// phrase-by-phrase scan sequential. Needs n more integers than kkp.
+// With speculative_parse the longest previous factor of every position is
+// also computed in parallel (parallel_lpf), and the scan merely jumps from
+// phrase start to phrase start. This compares every position against
+// both its PSV and its NSV instead of only the phrase starts, and on
+// repetitive input long matches are recomputed by every block (see
+// parallel_lpf), so it pays off with several threads only.
+template<typename saidx_t>
+long kkp_parallel(unsigned char *X, saidx_t *SA, long n, long nblocks,
+    bool speculative_parse, std::vector<std::pair<saidx_t, saidx_t> > *F,
+    std::vector<ref_count_t<saidx_t> >& reference_counters) {
+  saidx_t *PSV = new saidx_t[n + 1];
+  saidx_t *NSV = new saidx_t[n + 1];
+  PSV[0] = NSV[0] = 0;
+  parallel_ansv<saidx_t>(SA, n, PSV, false, nblocks);
+  parallel_ansv<saidx_t>(SA, n, NSV, true, nblocks);
+
+  // Compute the phrases.
+  long nfactors = 0;
+  if (speculative_parse) {
+    parallel_lpf<saidx_t>(X, n, PSV, NSV, nblocks);
+    for (saidx_t t = 1; t <= n; ++nfactors)
+      t = record_phrase<saidx_t>(X, n, t - 1, PSV[t], NSV[t], F, reference_counters) + 1;
+  } else {
+    for (saidx_t t = 1; t <= n; ++nfactors)
+      t = parse_phrase<saidx_t>(X, n, t - 1, PSV[t] - 1, NSV[t] - 1, F, reference_counters) + 1;
+  }
+
+  for (long j = 1; j < n; ++j)
+    reference_counters[j] += reference_counters[j - 1];
+
+  delete[] PSV;
+  delete[] NSV;
+  return nfactors;
+}
+
+long kkp2_blocks(long n) {
+#ifdef _OPENMP
+  // Blocks smaller than 2^ANSV_BLOCK_BITS are not worth the extra memory.
+  return std::max(1L, std::min((long)omp_get_max_threads(), n >> ANSV_BLOCK_BITS));
+#else
+  (void)n;
+  return 1;
+#endif
+}
+
+template<typename saidx_t>
+long kkp2(unsigned char *X, saidx_t *SA, long n,
+    std::vector<std::pair<saidx_t, saidx_t> > *F, std::vector<ref_count_t<saidx_t> >& reference_counters,
+    bool parallel_parse) {
+  long nblocks = kkp2_blocks(n);
+  if (nblocks > 1)
+    return kkp_parallel<saidx_t>(X, SA, n, nblocks, parallel_parse, F, reference_counters);
+  SA_reader<saidx_t> reader(SA);
+  return kkp<saidx_t>(X, reader, n, F, reference_counters);
+}
+
+template<typename saidx_t>
+saidx_t parse_phrase(unsigned char *X, saidx_t n, saidx_t i, saidx_t psv, saidx_t nsv,
+                 std::vector<std::pair<saidx_t, saidx_t>> *F, std::vector<ref_count_t<saidx_t> >& reference_counters)
 {
-  int pos, len = 0;
+  saidx_t pos, len = 0;
 
+  // psv and nsv are smaller than i, so matches are only bounded by n - i.
   if (nsv == -1)
   {
-    while (psv + len < n && i + len < n && X[psv + len] == X[i + len]) {
-      int ref_pos = psv + len;
-      if (ref_pos >= 0 && ref_pos < n) {
-        ++reference_counters[ref_pos].first;
-      }
-      ++len;
-    }
+    // psv is -1 too for a symbol that has not occurred before.
+    if (psv != -1)
+      len = match_length(X + psv, X + i, 0, n - i);
     pos = psv;
   }
   else if (psv == -1)
   {
-    while (i + len < n && X[nsv + len] == X[i + len]) {
-      int ref_pos = nsv + len;
-      if (ref_pos >= 0 && ref_pos < n) {
-        ++reference_counters[ref_pos].first;
-      }
-      ++len;
-    }
+    len = match_length(X + nsv, X + i, 0, n - i);
     pos = nsv;
   }
   else
   {
-    while (psv + len < n && nsv + len < n && X[psv + len] == X[nsv + len]) {
-      int ref_pos = psv + len;
-      if (ref_pos >= 0 && ref_pos < n) {
-        ++reference_counters[ref_pos].first;
-      }
-      ++len;
-    }
+    len = match_length(X + psv, X + nsv, 0, n - std::max(psv, nsv));
 
     if (i + len < n && X[i + len] == X[psv + len])
     {
-      int ref_pos = psv + len;
-      if (ref_pos >= 0 && ref_pos < n) {
-        ++reference_counters[ref_pos].first;
-      }
-      ++len;
-      
-      while (i + len < n && X[i + len] == X[psv + len]) {
-        ref_pos = psv + len;
-        if (ref_pos >= 0 && ref_pos < n) {
-          ++reference_counters[ref_pos].first;
-        }
-        ++len;
-      }
+      len = match_length(X + psv, X + i, len + 1, n - i);
       pos = psv;
     }
     else
     {
-      while (i + len < n && X[i + len] == X[nsv + len]) {
-        int ref_pos = nsv + len;
-        if (ref_pos >= 0 && ref_pos < n) {
-          ++reference_counters[ref_pos].first;
-        }
-        ++len;
-      }
+      len = match_length(X + nsv, X + i, len, n - i);
       pos = nsv;
     }
   }
 
+  return record_phrase<saidx_t>(X, n, i, pos, len, F, reference_counters);
+}
+
+template<typename saidx_t>
+saidx_t record_phrase(unsigned char *X, saidx_t n, saidx_t i, saidx_t pos, saidx_t len,
+                 std::vector<std::pair<saidx_t, saidx_t>> *F, std::vector<ref_count_t<saidx_t> >& reference_counters)
+{
+  // Mark the source range [pos, pos + len) in the difference array, kkp
+  // turns it into per-position counts once the parsing is done.
+  if (len > 0) {
+    ++reference_counters[pos];
+    if (pos + len < n) --reference_counters[pos + len];
+  }
+
   if (len == 0) {
     pos = X[i];
   }
@@ -176,5 +346,14 @@ int parse_phrase(unsigned char *X, int n, int i, int psv, int nsv,
     F->push_back(std::make_pair(pos, len));
   }
   
-  return i + std::max(1, len);
-}
\ No newline at end of file
+  return i + std::max((saidx_t)1, len);
+}
+
+template long kkp1<int>(unsigned char *, std::string, long,
+    std::vector<std::pair<int, int> > *, std::vector<ref_count_t<int> >&);
+template long kkp1<long>(unsigned char *, std::string, long,
+    std::vector<std::pair<long, long> > *, std::vector<ref_count_t<long> >&);
+template long kkp2<int>(unsigned char *, int *, long,
+    std::vector<std::pair<int, int> > *, std::vector<ref_count_t<int> >&, bool);
+template long kkp2<long>(unsigned char *, long *, long,
+    std::vector<std::pair<long, long> > *, std::vector<ref_count_t<long> >&, bool);
\ No newline at end of file
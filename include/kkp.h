@@ -30,30 +30,65 @@
 #ifndef __KKP_H
 #define __KKP_H
 
+#include <stdint.h>
+
 #include <string>
 #include <vector>
+#include <type_traits>
+
+// Number of phrase source occurrences covering a text position. A position
+// is covered at most once per phrase, and a text of length n has at most n
+// phrases, so 32 bits suffice for a 32-bit suffix array (n < 2^31). Texts
+// with a 64-bit suffix array may exceed 4GiB, and have 64-bit counts.
+template<typename saidx_t>
+using ref_count_t = typename std::conditional<sizeof(saidx_t) <= 4,
+    uint32_t, uint64_t>::type;
 
-// Two functions below share the same interface.
 // Arguments:
 //   X[0..n-1] = input string,
-//   SA[0..n-1] = suffix array of X,
+//   SA[0..n-1] = suffix array of X, saidx_t is int or long depending on
+//     the width of the suffix array,
 //   F = a pointer (can to be NULL) to a container storing the output
 //     parsing as a sequence of pairs (pos, len) where pos is a previous
 //     phrase occurrence (assuming len > 0) and len is the phrase length.
 //     If len = 0, then pos holds the next text symbol.
+//   reference_counters[0..n-1] = zero-initialized on entry, on return holds
+//     for every text position the number of phrases copying it.
 // Returns:
 //   the number of phrases in the parsing of X.
-int kkp2(unsigned char *X, int *SA, int n,
-    std::vector<std::pair<int, int> > *F, std::vector<std::pair<size_t,size_t>>& reference_counters);
+// With more than one OpenMP thread and n >= 2^17, PSV and NSV are computed
+// in parallel at the cost of n extra integers; the output is the same.
+// parallel_parse then also computes the phrase candidates of all positions
+// in parallel, leaving only the jumps between phrase starts sequential.
+// Otherwise parallel_parse has no effect.
+template<typename saidx_t>
+long kkp2(unsigned char *X, saidx_t *SA, long n,
+    std::vector<std::pair<saidx_t, saidx_t> > *F, std::vector<ref_count_t<saidx_t> >& reference_counters,
+    bool parallel_parse = false);
+
+// Minimum number of suffix array entries per block of the parallel
+// PSV/NSV computation.
+#define ANSV_BLOCK_BITS 16
+
+// Number of blocks kkp2 splits a text of length n into for the parallel
+// PSV/NSV computation, or 1 if it runs sequentially.
+long kkp2_blocks(long n);
 
+// Semi-external version of kkp2: the suffix array is streamed from disk,
+// so only X and a single array of n integers are held in memory.
 // Arguments:
 //   X[0..n-1] = input string,
-//   SA_fname = name of the file holding the suffix array of X,
+//   SA_fname = name of the file holding the suffix array of X, with
+//     entries of type saidx_t,
 //   F = a pointer (can to be NULL) to a container storing the output
 //     parsing as a sequence of pairs (pos, len) where pos is a previous
 //     phrase occurrence (assuming len > 0) and len is the phrase length.
 //     If len = 0, then pos holds the next text symbol.
+//   reference_counters[0..n-1] = as in kkp2.
 // Returns:
 //   the number of phrases in the parsing of X.
+template<typename saidx_t>
+long kkp1(unsigned char *X, std::string SA_fname, long n,
+    std::vector<std::pair<saidx_t, saidx_t> > *F, std::vector<ref_count_t<saidx_t> >& reference_counters);
 
 #endif // __KKP_H
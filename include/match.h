@@ -0,0 +1,75 @@
+////////////////////////////////////////////////////////////////////////////////
+// match.h
+//   Match extension kernels: length of the common prefix of two strings.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __MATCH_H
+#define __MATCH_H
+
+#include <stdint.h>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define MATCH_HAVE_AVX2
+#endif
+
+// All kernels return the smallest l in [len, max_len) with a[l] != b[l],
+// or max_len if there is none. a[0..len-1] and b[0..len-1] are assumed
+// equal and are not compared. Both strings must be readable up to
+// max_len - 1, nothing past it is read.
+
+// One symbol at a time.
+inline long match_length_bytes(const unsigned char *a, const unsigned char *b,
+    long len, long max_len) {
+  while (len < max_len && a[len] == b[len]) ++len;
+  return len;
+}
+
+// Eight symbols at a time: the first mismatching byte is the lowest
+// (highest on big-endian targets) set byte of the XOR of two words.
+inline long match_length_words(const unsigned char *a, const unsigned char *b,
+    long len, long max_len) {
+  while (len + 8 <= max_len) {
+    uint64_t x, y;
+    std::memcpy(&x, a + len, 8);
+    std::memcpy(&y, b + len, 8);
+    if (x != y) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      return len + (__builtin_clzll(x ^ y) >> 3);
+#else
+      return len + (__builtin_ctzll(x ^ y) >> 3);
+#endif
+    }
+    len += 8;
+  }
+  return match_length_bytes(a, b, len, max_len);
+}
+
+#ifdef MATCH_HAVE_AVX2
+// 32 symbols at a time. Only call it if the CPU supports AVX2; the build
+// uses it for match_length when compiled with -mavx2 (or -march=native).
+__attribute__((target("avx2")))
+inline long match_length_avx2(const unsigned char *a, const unsigned char *b,
+    long len, long max_len) {
+  while (len + 32 <= max_len) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(a + len));
+    __m256i y = _mm256_loadu_si256((const __m256i *)(b + len));
+    uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+    if (mask) return len + __builtin_ctz(mask);
+    len += 32;
+  }
+  return match_length_words(a, b, len, max_len);
+}
+#endif
+
+inline long match_length(const unsigned char *a, const unsigned char *b,
+    long len, long max_len) {
+#if defined(MATCH_HAVE_AVX2) && defined(__AVX2__)
+  return match_length_avx2(a, b, len, max_len);
+#else
+  return match_length_words(a, b, len, max_len);
+#endif
+}
+
+#endif // __MATCH_H
@@ -0,0 +1,120 @@
+////////////////////////////////////////////////////////////////////////////////
+// metrics.cpp
+//   Implementation of the per-stage measurements.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <sys/resource.h>
+
+#include <string>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#include "metrics.h"
+#include "common.h"
+
+// Peak RSS in kB: VmHWM, which clear_refs resets, or the lifetime maximum
+// reported by getrusage if /proc is not available.
+static long peak_rss() {
+  std::FILE *f = std::fopen("/proc/self/status", "r");
+  if (f) {
+    char line[256];
+    long kb = -1;
+    while (std::fgets(line, sizeof(line), f))
+      if (!std::strncmp(line, "VmHWM:", 6)) kb = std::atol(line + 6);
+    std::fclose(f);
+    if (kb >= 0) return kb;
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static void reset_peak_rss() {
+  std::FILE *f = std::fopen("/proc/self/clear_refs", "w");
+  if (!f) return;
+  std::fputs("5", f);
+  std::fclose(f);
+}
+
+void metrics::start(const std::string &name) {
+  stop();
+  reset_peak_rss();
+  for (current = 0; current < stages.size(); ++current)
+    if (stages[current].name == name) break;
+  if (current == stages.size()) {
+    stage s;
+    s.name = name;
+    s.wall = 0;
+    s.cpu = 0;
+    s.peak_rss = 0;
+    stages.push_back(s);
+  }
+  running = true;
+  timestamp = std::clock();
+  wtimestamp = wclock();
+}
+
+void metrics::stop() {
+  if (!running) return;
+  stages[current].wall += welapsed(wtimestamp);
+  stages[current].cpu += elapsed(timestamp);
+  stages[current].peak_rss = std::max(stages[current].peak_rss, peak_rss());
+  running = false;
+}
+
+void metrics::add(const std::string &name, long value) {
+  for (size_t i = 0; i < counters.size(); ++i)
+    if (counters[i].first == name) {
+      counters[i].second += value;
+      return;
+    }
+  counters.push_back(std::make_pair(name, value));
+}
+
+const metrics::stage *metrics::find(const std::string &name) const {
+  for (size_t i = 0; i < stages.size(); ++i)
+    if (stages[i].name == name) return &stages[i];
+  return NULL;
+}
+
+long metrics::counter(const std::string &name) const {
+  for (size_t i = 0; i < counters.size(); ++i)
+    if (counters[i].first == name) return counters[i].second;
+  return 0;
+}
+
+// Stage and counter names are plain identifiers, tool names too, so
+// nothing needs escaping.
+void metrics::write_json(std::ostream &out, const std::string &tool) const {
+  out << "{\n  \"tool\": \"" << tool << "\",\n  \"stages\": [";
+  for (size_t i = 0; i < stages.size(); ++i) {
+    out << (i ? ",\n" : "\n") << "    {\"name\": \"" << stages[i].name
+      << "\", \"wall_s\": " << stages[i].wall << ", \"cpu_s\": "
+      << stages[i].cpu << ", \"peak_rss_kb\": " << stages[i].peak_rss << "}";
+  }
+  out << "\n  ],\n  \"counters\": {";
+  for (size_t i = 0; i < counters.size(); ++i) {
+    out << (i ? ",\n" : "\n") << "    \"" << counters[i].first << "\": "
+      << counters[i].second;
+  }
+  out << "\n  }\n}\n";
+}
+
+void metrics::write_json(const char *fname, const std::string &tool) const {
+  if (!std::strcmp(fname, "-")) {
+    write_json(std::cout, tool);
+    return;
+  }
+  std::ofstream f(fname);
+  write_json(f, tool);
+  if (!f) {
+    std::cerr << "\nError: cannot write " << fname << "\n";
+    std::exit(EXIT_FAILURE);
+  }
+}
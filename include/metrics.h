@@ -0,0 +1,70 @@
+////////////////////////////////////////////////////////////////////////////////
+// metrics.h
+//   Per-stage time and memory measurements, reported as JSON.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#include <ctime>
+#include <string>
+#include <vector>
+#include <utility>
+#include <iostream>
+
+// Compile-time verbosity of the progress messages on stderr: 0 = errors and
+// warnings only, 1 = one line per stage (LOG_INFO, default), 2 = also one
+// trace line per step of the greedy selection (LOG_TRACE). Messages above
+// LOG_LEVEL are compiled out.
+#ifndef LOG_LEVEL
+#define LOG_LEVEL 1
+#endif
+
+#define LOG_INFO(msg) \
+  do { if (LOG_LEVEL >= 1) std::cerr << msg; } while (0)
+#define LOG_TRACE(msg) \
+  do { if (LOG_LEVEL >= 2) std::cerr << msg; } while (0)
+
+// Collects the wallclock time, CPU time (of all threads) and peak resident
+// set size of consecutive stages, plus named counters. Only one stage runs
+// at a time: starting a stage stops the current one. Starting a stage that
+// already ran resumes it, adding to its times.
+class metrics {
+  public:
+    struct stage {
+      std::string name;
+      long double wall;   // seconds
+      double cpu;         // seconds
+      long peak_rss;      // kB, see start()
+    };
+
+    metrics() : running(false), current(0) {}
+
+    // Starts timing stage name. The peak RSS is reset through
+    // /proc/self/clear_refs where the kernel allows it, so that it is the
+    // peak of this stage; elsewhere it is the peak of the process so far.
+    void start(const std::string &name);
+    void stop();
+
+    // Adds value to the counter name, created at zero on first use.
+    void add(const std::string &name, long value);
+
+    const stage *find(const std::string &name) const;
+    long counter(const std::string &name) const;
+
+    // Writes {"tool": ..., "stages": [...], "counters": {...}} to out.
+    void write_json(std::ostream &out, const std::string &tool) const;
+
+    // Writes the JSON to fname, or to stdout if fname is "-".
+    void write_json(const char *fname, const std::string &tool) const;
+
+  private:
+    std::vector<stage> stages;
+    std::vector<std::pair<std::string, long> > counters;
+    bool running;
+    size_t current;     // index of the running stage
+    long double wtimestamp;
+    std::clock_t timestamp;
+};
+
+#endif // __METRICS_H
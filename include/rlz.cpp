@@ -0,0 +1,217 @@
+////////////////////////////////////////////////////////////////////////////////
+// rlz.cpp
+//   Implementation of RLZ parsing and of the encoded phrase stream.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+#include "rlz.h"
+#include "common.h"
+
+#define RLZ_BLOCK_SIZE (1L << 20)
+
+// Returns the longest prefix of X[0..n-1] occurring in R[0..m-1] as a
+// pair (pos, len), narrowing the suffix array interval one symbol at a
+// time. Suffixes of R shorter than the current depth sort first.
+template<typename saidx_t>
+std::pair<long, long> longest_match(const unsigned char *X, long n,
+    const unsigned char *R, long m, const saidx_t *SA) {
+  long lo = 0, hi = m, len = 0, pos = 0;
+  while (len < n && lo < hi) {
+    int c = X[len];
+    const saidx_t *first = std::lower_bound(SA + lo, SA + hi, c,
+        [&](saidx_t s, int x) {
+          return (s + len < m ? (int)R[s + len] : -1) < x; });
+    const saidx_t *last = std::upper_bound(first, SA + hi, c,
+        [&](int x, saidx_t s) {
+          return x < (s + len < m ? (int)R[s + len] : -1); });
+    if (first == last) break;
+    lo = first - SA;
+    hi = last - SA;
+    pos = SA[lo];
+    ++len;
+  }
+  if (len == 0) pos = X[0];
+  return std::make_pair(pos, len);
+}
+
+template<typename saidx_t>
+long rlz_parse(const unsigned char *X, long n, const unsigned char *R, long m,
+    std::vector<std::pair<long, long> > &F) {
+  saidx_t *SA = new saidx_t[std::max(m, 1L)];
+  construct_sa(R, SA, m);
+
+  long nblocks = (n + RLZ_BLOCK_SIZE - 1) / RLZ_BLOCK_SIZE;
+  std::vector<std::vector<std::pair<long, long> > > blocks(nblocks);
+  #pragma omp parallel for schedule(dynamic)
+  for (long b = 0; b < nblocks; ++b) {
+    long i = b * RLZ_BLOCK_SIZE, end = std::min(n, i + RLZ_BLOCK_SIZE);
+    while (i < end) {
+      std::pair<long, long> phrase =
+        longest_match<saidx_t>(X + i, end - i, R, m, SA);
+      blocks[b].push_back(phrase);
+      i += std::max(1L, phrase.second);
+    }
+  }
+  delete[] SA;
+
+  F.clear();
+  for (long b = 0; b < nblocks; ++b) {
+    F.insert(F.end(), blocks[b].begin(), blocks[b].end());
+    std::vector<std::pair<long, long> >().swap(blocks[b]);
+  }
+  return F.size();
+}
+
+long rlz_parse(const unsigned char *X, long n, const unsigned char *R, long m,
+    std::vector<std::pair<long, long> > &F) {
+  if (m >= SA64_THRESHOLD) return rlz_parse<long>(X, n, R, m, F);
+  else return rlz_parse<int>(X, n, R, m, F);
+}
+
+static inline void put_varint(std::vector<unsigned char> &buf, unsigned long x) {
+  while (x >= 128) {
+    buf.push_back((x & 127) | 128);
+    x >>= 7;
+  }
+  buf.push_back(x);
+}
+
+// Reads a varint at p, which must end before end. Returns false if it
+// does not, or if it does not fit in 63 bits.
+static inline bool get_varint(const unsigned char* &p, const unsigned char *end,
+    long &x) {
+  unsigned long v = 0;
+  for (int shift = 0; p < end && shift < 63; shift += 7) {
+    unsigned char b = *p++;
+    v |= (unsigned long)(b & 127) << shift;
+    if (b < 128) {
+      x = v;
+      return x >= 0;
+    }
+  }
+  return false;
+}
+
+static void rlz_error(const std::string &fname, const char *what) {
+  std::cerr << "\nError: " << fname << " " << what << "\n";
+  std::exit(EXIT_FAILURE);
+}
+
+long rlz_write(std::string fname, long n,
+    const std::vector<std::pair<long, long> > &F) {
+  std::vector<unsigned char> buf;
+  for (size_t j = 0; j < F.size(); ++j) {
+    put_varint(buf, F[j].second);
+    if (F[j].second) put_varint(buf, F[j].first);
+    else buf.push_back(F[j].first);
+  }
+
+  long z = F.size();
+  std::fstream f(fname.c_str(), std::fstream::out | std::fstream::binary);
+  f.write((char *)&n, sizeof(long));
+  f.write((char *)&z, sizeof(long));
+  f.write((char *)buf.data(), buf.size());
+  if (!f) {
+    std::cerr << "\nError: cannot write " << fname << "\n";
+    std::exit(EXIT_FAILURE);
+  }
+  f.close();
+  return 2 * sizeof(long) + buf.size();
+}
+
+long rlz_read(std::string fname, std::vector<std::pair<long, long> > &F) {
+  unsigned char *data;
+  long size;
+  map_text(fname.c_str(), data, size);
+  if (size < (long)(2 * sizeof(long)))
+    rlz_error(fname, "is not an RLZ phrase stream");
+  long n = ((long *)data)[0], z = ((long *)data)[1];
+  const unsigned char *p = data + 2 * sizeof(long), *end = data + size;
+  // Every phrase takes at least two bytes.
+  if (n < 0 || z < 0 || z > (end - p) / 2)
+    rlz_error(fname, "is not an RLZ phrase stream");
+  F.clear();
+  F.reserve(z);
+  for (long j = 0; j < z; ++j) {
+    long len, pos;
+    if (!get_varint(p, end, len)) rlz_error(fname, "is truncated or corrupt");
+    if (len) {
+      if (!get_varint(p, end, pos)) rlz_error(fname, "is truncated or corrupt");
+    } else {
+      if (p == end) rlz_error(fname, "is truncated or corrupt");
+      pos = *p++;
+    }
+    F.push_back(std::make_pair(pos, len));
+  }
+  unmap_file(data, size);
+  return n;
+}
+
+rlz_decoder::rlz_decoder(const std::string &R,
+    const std::vector<std::pair<long, long> > &F, long length)
+  : reference(R), n(length) {
+  long m = reference.size();
+
+  // Reject parsings of another text or against another reference, which
+  // would make extract read past the reference.
+  long pos = 0;
+  for (size_t j = 0; j < F.size(); ++j) {
+    long src = F[j].first, len = F[j].second;
+    if (len < 0 || (len > 0 && (src < 0 || src > m - len)) ||
+        (len == 0 && (src < 0 || src > 255))) {
+      std::cerr << "\nError: phrase " << j << " (" << src << ", " << len
+        << ") does not fit the reference of " << m << " bytes\n";
+      std::exit(EXIT_FAILURE);
+    }
+    pos += std::max(1L, len);
+    if (pos > n) break;
+  }
+  if (pos != n) {
+    std::cerr << "\nError: the phrase lengths do not add up to the text "
+      << "length of " << n << " bytes\n";
+    std::exit(EXIT_FAILURE);
+  }
+
+  sources = sdsl::int_vector<>(F.size(), 0, sdsl::bits::hi(m + 256) + 1);
+  sdsl::sd_vector_builder builder(n, F.size());
+  pos = 0;
+  for (size_t j = 0; j < F.size(); ++j) {
+    builder.set(pos);
+    sources[j] = F[j].second ? F[j].first : m + F[j].first;
+    pos += std::max(1L, F[j].second);
+  }
+  starts = sdsl::sd_vector<>(builder);
+  starts_rank = sdsl::sd_vector<>::rank_1_type(&starts);
+  starts_select = sdsl::sd_vector<>::select_1_type(&starts);
+}
+
+void rlz_decoder::extract(long pos, long len, unsigned char *out) const {
+  if (len <= 0) return;
+  long m = reference.size(), z = sources.size();
+  long j = starts_rank(pos + 1) - 1;
+  long start = starts_select(j + 1);
+  while (len > 0) {
+    long end = (j + 1 < z) ? (long)starts_select(j + 2) : n;
+    long src = sources[j];
+    long count = std::min(len, end - pos);
+    if (src >= m) *out = src - m;
+    else std::copy(reference.data() + src + (pos - start),
+        reference.data() + src + (pos - start) + count, out);
+    out += count;
+    len -= count;
+    pos = start = end;
+    ++j;
+  }
+}
+
+long rlz_decoder::size_in_bytes() const {
+  return sdsl::size_in_bytes(starts) + sdsl::size_in_bytes(sources);
+}
@@ -0,0 +1,79 @@
+////////////////////////////////////////////////////////////////////////////////
+// rlz.h
+//   Relative Lempel-Ziv (RLZ) parsing of a text against a reference.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __RLZ_H
+#define __RLZ_H
+
+#include <string>
+#include <vector>
+
+#include <sdsl/int_vector.hpp>
+#include <sdsl/sd_vector.hpp>
+
+// Greedy RLZ parsing: every phrase is the longest prefix of the rest of the
+// text that occurs in the reference, or a single literal symbol if there is
+// none. The text is cut into blocks of RLZ_BLOCK_SIZE symbols that are
+// parsed in parallel, so no phrase crosses a block boundary.
+// Arguments:
+//   X[0..n-1] = input string,
+//   R[0..m-1] = reference,
+//   F = container storing the output parsing as a sequence of pairs
+//     (pos, len) where pos is the phrase occurrence in R (assuming len > 0)
+//     and len is the phrase length. If len = 0, then pos holds the next
+//     text symbol.
+// Returns:
+//   the number of phrases in the parsing of X.
+long rlz_parse(const unsigned char *X, long n, const unsigned char *R, long m,
+    std::vector<std::pair<long, long> > &F);
+
+// Writes the parsing F of a text of length n to fname and returns the
+// number of bytes written. The file holds n and the number of phrases as
+// 64-bit integers followed by the phrases, each as a varint len and then
+// either a varint pos (len > 0) or the literal symbol byte (len = 0).
+long rlz_write(std::string fname, long n,
+    const std::vector<std::pair<long, long> > &F);
+
+// Reads a parsing written by rlz_write into F and returns n. Exits with an
+// error if the file is truncated or is not such a parsing.
+long rlz_read(std::string fname, std::vector<std::pair<long, long> > &F);
+
+// Random access to a text given by its RLZ parsing. The phrase starts are
+// kept in an sd_vector, so the phrase containing a position is found with
+// one rank query, and the phrase sources are bit-packed.
+class rlz_decoder {
+  public:
+    // R = reference, F = RLZ parsing of a text of length n against R.
+    // Exits with an error if a phrase does not fit in R, a literal is not
+    // a byte, or the phrase lengths do not add up to n.
+    rlz_decoder(const std::string &R, const std::vector<std::pair<long, long> > &F,
+        long n);
+
+    // Writes X[pos..pos+len-1] to out, in O(log z + len) time. Requires
+    // pos + len <= length().
+    void extract(long pos, long len, unsigned char *out) const;
+
+    long length() const { return n; }
+    long phrases() const { return sources.size(); }
+
+    // Size of the decoder in bytes, excluding the reference.
+    long size_in_bytes() const;
+
+  private:
+    rlz_decoder(const rlz_decoder &);
+    rlz_decoder &operator=(const rlz_decoder &);
+
+    std::string reference;
+    long n;
+
+    // Phrase j starts at starts_select(j + 1) and copies from
+    // reference[sources[j]..], or is the literal sources[j] - |R| if
+    // sources[j] >= |R|.
+    sdsl::sd_vector<> starts;
+    sdsl::sd_vector<>::rank_1_type starts_rank;
+    sdsl::sd_vector<>::select_1_type starts_select;
+    sdsl::int_vector<> sources;
+};
+
+#endif // __RLZ_H
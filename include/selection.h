@@ -0,0 +1,830 @@
+////////////////////////////////////////////////////////////////////////////////
+// selection.h
+//   Greedy selection of the reference windows from the reference counts.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __SELECTION_H
+#define __SELECTION_H
+
+#include <stdint.h>
+#include <ctime>
+#include <cstdlib>
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <sdsl/bit_vectors.hpp>
+
+#include "common.h"
+#include "kkp.h"
+#include "rlz.h"
+#include "metrics.h"
+
+// Indexed D-ary max-heap over the text positions. Each entry keeps its
+// score inline next to the position, so with index_t = uint32_t the heap
+// is 8 bytes per position plus 4 bytes for the position -> entry index map.
+// Ties are broken towards the smaller position.
+template<typename index_t, size_t D = 4>
+class IndexedHeap {
+  private:
+      struct entry {
+          index_t score;
+          index_t pos;
+      };
+
+      static constexpr index_t NONE = ~(index_t)0;
+
+      std::vector<entry> heap;
+      std::vector<index_t> pos_to_idx;
+
+      static bool before(const entry& a, const entry& b) {
+          return a.score > b.score || (a.score == b.score && a.pos < b.pos);
+      }
+
+      static index_t clamp(size_t score) {
+          return (index_t)std::min(score, (size_t)(NONE - 1));
+      }
+
+      void place(size_t idx, const entry& e) {
+          heap[idx] = e;
+          pos_to_idx[e.pos] = idx;
+      }
+
+      void heapify_up(size_t idx) {
+          entry e = heap[idx];
+          while (idx > 0) {
+              size_t parent = (idx - 1) / D;
+              if (!before(e, heap[parent]))
+                  break;
+              place(idx, heap[parent]);
+              idx = parent;
+          }
+          place(idx, e);
+      }
+
+      void heapify_down(size_t idx) {
+          size_t heap_size = heap.size();
+          entry e = heap[idx];
+          while (true) {
+              size_t first = D * idx + 1;
+              if (first >= heap_size) break;
+              size_t last = std::min(first + D, heap_size);
+              size_t best = first;
+              for (size_t child = first + 1; child < last; child++)
+                  if (before(heap[child], heap[best]))
+                      best = child;
+
+              if (!before(heap[best], e)) break;
+
+              place(idx, heap[best]);
+              idx = best;
+          }
+          place(idx, e);
+      }
+
+  public:
+      // Allocates a heap of size positions, whose scores are then given
+      // by set() and ordered by build().
+      IndexedHeap(size_t size) : heap(size), pos_to_idx(size) {}
+
+      // Sets the initial score of pos. Calls for different positions may
+      // run in parallel.
+      void set(size_t pos, size_t score) {
+          heap[pos].score = clamp(score);
+          heap[pos].pos = pos;
+          pos_to_idx[pos] = pos;
+      }
+
+      void build() {
+          size_t size = heap.size();
+          // Heapify bottom-up one level at a time. Subtrees rooted at the
+          // same level are disjoint, so each level is sifted in parallel.
+          if (size > 1) {
+              size_t last = (size - 2) / D;
+              std::vector<size_t> level_start(1, 0);
+              while (level_start.back() <= last)
+                  level_start.push_back(level_start.back() * D + 1);
+              for (size_t l = level_start.size() - 1; l-- > 0;) {
+                  size_t level_end = std::min(level_start[l + 1], last + 1);
+                  #pragma omp parallel for schedule(static)
+                  for (size_t i = level_start[l]; i < level_end; i++)
+                      heapify_down(i);
+              }
+          }
+      }
+
+      void update(size_t pos, size_t new_score) {
+          if (pos >= pos_to_idx.size()) return;
+          size_t idx = pos_to_idx[pos];
+          if (idx == NONE) return;
+          heap[idx].score = clamp(new_score);
+          heapify_up(idx);
+          heapify_down(pos_to_idx[pos]);
+      }
+
+      size_t top() const {
+          return heap[0].pos;
+      }
+
+      size_t extract_max() {
+          size_t max_pos = heap[0].pos;
+          pos_to_idx[max_pos] = NONE;
+          entry last = heap.back();
+          heap.pop_back();
+          if (!heap.empty()) {
+              place(0, last);
+              heapify_down(0);
+          }
+          return max_pos;
+      }
+
+      bool empty() {
+          return heap.empty();
+      }
+
+      size_t size() {
+          return heap.size();
+      }
+  };
+
+// Monotone bucket queue over the text positions, a drop-in alternative to
+// IndexedHeap for scores that never increase (as in the greedy selection,
+// where windows only gain selected positions). There is one bucket per
+// score up to the largest initial one, which is at most n since it is a
+// sum of reference counts. Each bucket is a doubly linked list threaded
+// through per-position prev/next links, so update() unlinks a position
+// and pushes it onto its new bucket in O(1), and the queue takes a fixed
+// 3 integers per position plus one per score however many updates it
+// sees. A bucket is sorted by position when it becomes the top one, and
+// no position can enter it afterwards, so ties go to the smaller position
+// as in IndexedHeap and both structures extract the positions in the same
+// order. Walking the buckets down costs amortized O(1) per extract_max(),
+// but a top bucket of b positions costs O(b) to check and O(b log b) to
+// sort if updates landed in it: O(n log n) over all extractions in the
+// worst case, O(n) when every bucket is still in position order.
+template<typename index_t>
+class BucketQueue {
+  private:
+      static constexpr index_t NONE = ~(index_t)0;
+
+      std::vector<index_t> scores;  // current score, NONE once extracted
+      std::vector<index_t> prev;    // neighbours in the list of the bucket
+      std::vector<index_t> next;
+      std::vector<index_t> head;    // first position of each bucket
+      size_t level;                 // score of the top bucket
+      size_t sorted;                // the bucket sorted by position, if any
+      size_t live;
+
+      static index_t clamp(size_t score) {
+          return (index_t)std::min(score, (size_t)(NONE - 1));
+      }
+
+      void link(size_t pos) {
+          index_t first = head[scores[pos]];
+          prev[pos] = NONE;
+          next[pos] = first;
+          if (first != NONE) prev[first] = pos;
+          head[scores[pos]] = pos;
+      }
+
+      void unlink(size_t pos) {
+          if (prev[pos] != NONE) next[prev[pos]] = next[pos];
+          else head[scores[pos]] = next[pos];
+          if (next[pos] != NONE) prev[next[pos]] = prev[pos];
+      }
+
+      // Merges two lists sorted by position, linked through next only.
+      index_t merge(index_t a, index_t b) {
+          index_t first = NONE, *tail = &first;
+          while (a != NONE && b != NONE) {
+              index_t& smaller = (a < b) ? a : b;
+              *tail = smaller;
+              tail = &next[smaller];
+              smaller = next[smaller];
+          }
+          *tail = (a != NONE) ? a : b;
+          return first;
+      }
+
+      // Sorts the list of bucket s by position in place, with the bottom-up
+      // merge sort of std::list::sort: lists[i] holds a sorted run of 2^i
+      // positions. Buckets nobody updated are sorted already.
+      void sort_bucket(size_t s) {
+          index_t e = head[s];
+          while (e != NONE && (next[e] == NONE || e < next[e])) e = next[e];
+          if (e == NONE) return;
+          index_t lists[64];
+          std::fill(lists, lists + 64, NONE);
+          for (e = head[s]; e != NONE; ) {
+              index_t carry = e;
+              e = next[e];
+              next[carry] = NONE;
+              size_t i = 0;
+              for (; lists[i] != NONE; i++) {
+                  carry = merge(lists[i], carry);
+                  lists[i] = NONE;
+              }
+              lists[i] = carry;
+          }
+          index_t result = NONE;
+          for (size_t i = 0; i < 64; i++)
+              if (lists[i] != NONE) result = merge(lists[i], result);
+          head[s] = result;
+          for (index_t p = NONE, q = result; q != NONE; p = q, q = next[q])
+              prev[q] = p;
+      }
+
+  public:
+      // Allocates a queue of size positions, whose scores are then given
+      // by set() and bucketed by build().
+      BucketQueue(size_t size)
+          : scores(size), prev(size), next(size), level(0), sorted(0), live(size) {}
+
+      // Sets the initial score of pos. Calls for different positions may
+      // run in parallel.
+      void set(size_t pos, size_t score) {
+          scores[pos] = clamp(score);
+      }
+
+      void build() {
+          size_t size = scores.size();
+          size_t max_score = 0;
+          for (size_t i = 0; i < size; i++)
+              max_score = std::max(max_score, (size_t)scores[i]);
+          head.assign(max_score + 1, NONE);
+          // Pushing the positions from the last one leaves every bucket
+          // sorted.
+          for (size_t i = size; i-- > 0;)
+              link(i);
+          level = max_score;
+          sorted = max_score + 1;
+      }
+
+      void update(size_t pos, size_t new_score) {
+          if (pos >= scores.size() || scores[pos] == NONE) return;
+          index_t score = clamp(new_score);
+          if (score == scores[pos]) return;
+          unlink(pos);
+          scores[pos] = score;
+          link(pos);
+      }
+
+      size_t top() {
+          while (head[level] == NONE) level--;
+          if (sorted != level) {
+              sort_bucket(level);
+              sorted = level;
+          }
+          return head[level];
+      }
+
+      size_t extract_max() {
+          size_t pos = top();
+          unlink(pos);
+          scores[pos] = NONE;
+          live--;
+          return pos;
+      }
+
+      bool empty() {
+          return live == 0;
+      }
+
+      size_t size() {
+          return live;
+      }
+  };
+
+// height_sums[i] is the sum of the heights of positions [0, i). The
+// heights add up to at most n (every phrase copies as many positions as
+// its length), so sum_t only has to hold n.
+template<typename sum_t, typename count_t>
+std::vector<sum_t> prefix_sums(const std::vector<count_t>& heights)
+{
+    std::vector<sum_t> height_sums(heights.size() + 1, 0);
+    for (size_t i = 0; i < heights.size(); i++)
+    {
+      height_sums[i + 1] = height_sums[i] + heights[i];
+    }
+    return height_sums;
+}
+
+// Bounds [start, end) of the k-window centred on pos, [pos - k/2,
+// pos - k/2 + k), so an odd k has (k - 1)/2 symbols on each side of pos
+// and an even one one more on the left. It is clipped to the file
+// containing pos so that no window spans two files of a collection (see
+// map_input). The separator after a file is never part of a window; its
+// own window is [pos - k/2, pos), the tail of the file it ends.
+inline void window_bounds(size_t pos, const std::vector<long>& file_starts, size_t k, size_t& start, size_t& end)
+{
+    size_t lo = 0, hi = file_starts[1] - 1;
+    if (file_starts.size() > 2)
+    {
+        size_t f = std::upper_bound(file_starts.begin(), file_starts.end(), (long)pos) - file_starts.begin() - 1;
+        lo = file_starts[f];
+        hi = file_starts[f + 1] - 1;
+    }
+
+    if (pos > lo + k / 2)
+    {
+        start = pos - k / 2;
+    }
+    else
+    {
+        start = lo;
+    }
+
+    end = pos + (k - k / 2);
+    if (end > hi)
+    {
+        end = hi;
+    }
+    if (start > end)
+    {
+        start = end;
+    }
+}
+
+struct record_pos
+{
+  size_t sum_height = 0;
+  size_t already_seen_positions = 1;
+};
+
+// Mask of the len <= 64 low bits.
+inline uint64_t low_bits(size_t len)
+{
+    return len >= 64 ? ~(uint64_t)0 : ((uint64_t)1 << len) - 1;
+}
+
+// Number of set bits of bv in [start, end), read a 64-bit word at a time,
+// so a k-window takes at most k / 64 + 1 popcounts.
+inline size_t count_ones(const sdsl::bit_vector& bv, size_t start, size_t end)
+{
+    size_t count = 0;
+    for (; start + 64 <= end; start += 64)
+        count += __builtin_popcountll(bv.get_int(start, 64));
+    if (start < end)
+        count += __builtin_popcountll(bv.get_int(start, end - start));
+    return count;
+}
+
+template<typename sum_t>
+record_pos peek_record_positions(size_t middle_pos, const sdsl::bit_vector& bv, const std::vector<sum_t>& height_sums, const std::vector<long>& file_starts, size_t k)
+{
+    record_pos recorded_positions;
+    size_t start, end;
+    window_bounds(middle_pos, file_starts, k, start, end);
+
+    recorded_positions.sum_height = height_sums[end] - height_sums[start];
+    recorded_positions.already_seen_positions += count_ones(bv, start, end);
+
+    return recorded_positions;
+}
+
+// Marks the window of candidate as selected and appends its symbols that
+// were not selected yet to reference. The window is taken a word of bv at
+// a time: the unselected positions are the clear bits, visited lowest
+// first.
+inline void append_window(size_t candidate, sdsl::bit_vector& bv, unsigned char* text, const std::vector<long>& file_starts, size_t k, std::string& reference)
+{
+    size_t start, end;
+    size_t offset = reference.size();
+    window_bounds(candidate, file_starts, k, start, end);
+
+    for (size_t i = start; i < end; i += 64)
+    {
+      size_t len = std::min((size_t)64, end - i);
+      uint64_t unselected = ~bv.get_int(i, len) & low_bits(len);
+      for (; unselected; unselected &= unselected - 1)
+        reference += text[i + __builtin_ctzll(unselected)];
+      bv.set_int(i, low_bits(len), len);
+    }
+    LOG_TRACE("Candidate string: " << reference.substr(offset) << "\n");
+}
+
+template<typename sum_t>
+size_t score(size_t candidate, const sdsl::bit_vector& bv, const std::vector<sum_t>& height_sums, const std::vector<long>& file_starts, size_t k)
+{
+    size_t start, end;
+    window_bounds(candidate, file_starts, k, start, end);
+
+    size_t sum = height_sums[end] - height_sums[start];
+    size_t denom = count_ones(bv, start, end);
+    return sum / std::max(1UL, denom);
+}
+
+// Priority queues available to the greedy selection.
+enum queue_type { INDEXED_HEAP, BUCKET_QUEUE };
+
+// The positions that enter the queue, in increasing order, with queue slot
+// i holding positions[i]. all means every position, with slot i = i.
+// index_t is the integer type of the queue, so positions take 4 bytes per
+// candidate below 4GiB.
+template<typename index_t>
+struct candidate_set
+{
+  bool all;
+  size_t size;                // number of queue slots
+  std::vector<index_t> positions;
+  size_t pruned_max;          // upper bound on the score of left-out positions
+
+  size_t position(size_t slot) const { return all ? slot : positions[slot]; }
+
+  // First slot holding a position >= pos.
+  size_t slot(size_t pos) const
+  {
+    return all ? pos : std::lower_bound(positions.begin(), positions.end(), pos) - positions.begin();
+  }
+};
+
+// Parameters of the greedy selection.
+struct selection_params
+{
+  queue_type queue;           // priority queue of the positions
+  bool lazy;                  // rescore positions only at the queue top
+  size_t min_score;           // if nonzero, only positions scoring at
+                              // least min_score enter the queue
+  size_t max_candidates;      // if nonzero, only the max_candidates best
+                              // positions enter the queue
+  size_t k;                   // window length
+  std::vector<size_t> budgets; // reference sizes to produce, ascending
+  const char *output_prefix;  // references go to output_prefix.<budget>,
+                              // and are not written if NULL
+  bool rlz;                   // RLZ-compress the text against each
+                              // reference into the reference file name
+                              // plus .rlz; needs output_prefix
+  metrics *stats;             // if not NULL, receives the stages scoring,
+                              // heap_build, greedy, write_reference and
+                              // rlz, and the counters
+                              // heap_operations, reference_bytes and
+                              // bytes_written
+};
+
+inline void write_reference(const selection_params& params, size_t budget, const std::string& reference)
+{
+  if (params.stats) params.stats->add("reference_bytes", reference.size());
+  if (!params.output_prefix) return;
+  std::string fname = std::string(params.output_prefix) + "." + std::to_string(budget);
+  std::ofstream f(fname.c_str(), std::ios::binary);
+  f.write(reference.data(), reference.size());
+  if (!f)
+  {
+    std::cerr << "\nError: cannot write " << fname << "\n";
+    std::exit(EXIT_FAILURE);
+  }
+  if (params.stats) params.stats->add("bytes_written", reference.size());
+  LOG_INFO("Wrote reference of " << reference.size() << " bytes (budget "
+    << budget << ") to " << fname << "\n");
+}
+
+// Streams the reference for the largest budget to output_prefix.<budget>
+// while the windows are selected, and the selected windows to the sidecar
+// output_prefix.<budget>.pos: one record of three longs per window, its
+// centre position, its score when it was selected and the offset of its
+// symbols in the reference. The windows of the reference for a smaller
+// budget are the records with an offset below its size. Without an
+// output_prefix nothing is streamed.
+class reference_stream
+{
+  private:
+      const selection_params& params;
+      std::string fname;
+      std::ofstream ref_file, pos_file;
+
+      void check(std::ofstream& f, const std::string& name)
+      {
+          if (!f)
+          {
+              std::cerr << "\nError: cannot write " << name << "\n";
+              std::exit(EXIT_FAILURE);
+          }
+      }
+
+  public:
+      reference_stream(const selection_params& p) : params(p)
+      {
+          if (!params.output_prefix) return;
+          fname = std::string(params.output_prefix) + "." + std::to_string(params.budgets.back());
+          ref_file.open(fname.c_str(), std::ios::binary);
+          check(ref_file, fname);
+          pos_file.open((fname + ".pos").c_str(), std::ios::binary);
+          check(pos_file, fname + ".pos");
+      }
+
+      bool is_open() const { return ref_file.is_open(); }
+
+      // Writes the symbols of the window at candidate, which start at
+      // reference[offset], and its record.
+      void append(const std::string& reference, size_t offset, size_t candidate, size_t candidate_score)
+      {
+          if (!is_open()) return;
+          ref_file.write(reference.data() + offset, reference.size() - offset);
+          long record[3] = { (long)candidate, (long)candidate_score, (long)offset };
+          pos_file.write((const char *)record, sizeof(record));
+      }
+
+      // Closes both files once the reference has reached the largest budget.
+      void finish(const std::string& reference, long windows)
+      {
+          ref_file.close();
+          check(ref_file, fname);
+          pos_file.close();
+          check(pos_file, fname + ".pos");
+          if (params.stats)
+          {
+              params.stats->add("reference_bytes", reference.size());
+              params.stats->add("bytes_written", reference.size() + windows * 3 * sizeof(long));
+          }
+          LOG_INFO("Wrote reference of " << reference.size() << " bytes (budget "
+            << params.budgets.back() << ") to " << fname << " and its " << windows
+            << " windows to " << fname << ".pos\n");
+      }
+  };
+
+// Parses the text against the reference, writes the encoded phrases and
+// reports the compressed size and the parsing throughput.
+inline void compress_with_reference(const selection_params& params, size_t budget, const std::string& reference, const unsigned char* text, size_t n)
+{
+  std::string fname = std::string(params.output_prefix) + "." + std::to_string(budget) + ".rlz";
+
+  LOG_INFO("RLZ parsing against the reference... ");
+  long double wtimestamp = wclock();
+  std::vector<std::pair<long, long>> phrases;
+  rlz_parse(text, n, (const unsigned char *)reference.data(), reference.size(), phrases);
+  long double parse_time = welapsed(wtimestamp);
+  long size = rlz_write(fname, n, phrases);
+  if (params.stats) params.stats->add("bytes_written", size);
+  LOG_INFO(phrases.size() << " phrases, " << size << " bytes written to " << fname
+    << " (" << (n ? 100.0 * size / n : 0.0) << "% of the input), "
+    << (parse_time > 0 ? n / parse_time / 1e6 : 0.0) << " MB/s\n");
+}
+
+// Picks the positions that enter the queue: those with a score of at least
+// params.min_score, and of these at most params.max_candidates, the best
+// ones by (score, smaller position) as in the queues. Without either
+// option every position is a candidate and nothing is scored here.
+// Otherwise the scores of all positions are held as index_t, 4n bytes below
+// 4GiB, and released on return, before the queue is allocated. The score of
+// the last of the best M is found with a histogram of the scores, at most
+// max score + 1 integers, and the candidates are counted before their
+// positions are allocated.
+template<typename index_t, typename sum_t>
+candidate_set<index_t> select_candidates(const sdsl::bit_vector& bv, const std::vector<sum_t>& height_sums, const std::vector<long>& file_starts, const selection_params& params)
+{
+  const size_t window = params.k;
+  size_t n = bv.size();
+  candidate_set<index_t> candidates;
+  candidates.all = true;
+  candidates.size = n;
+  candidates.pruned_max = 0;
+  bool prune_top = params.max_candidates && params.max_candidates < n;
+  if (params.min_score == 0 && !prune_top) return candidates;
+
+  // Scores are sums of heights, so they are at most n and fit in index_t.
+  if (params.stats) params.stats->start("scoring");
+  std::vector<index_t> score_vector(n);
+  size_t max_score = 0;
+  #pragma omp parallel for schedule(static) reduction(max:max_score)
+  for (size_t i = 0; i < n; i++)
+  {
+    score_vector[i] = score(i, bv, height_sums, file_starts, window);
+    max_score = std::max(max_score, (size_t)score_vector[i]);
+  }
+
+  size_t threshold = params.min_score;
+  size_t ties = n;            // positions scoring exactly threshold to keep
+  if (prune_top)
+  {
+    std::vector<index_t> histogram(max_score + 1, 0);
+    for (size_t i = 0; i < n; i++)
+      histogram[score_vector[i]]++;
+    // Walk down from the best score to the one of the M-th position.
+    size_t mth = max_score, above = 0;
+    while (above + histogram[mth] < params.max_candidates)
+      above += histogram[mth--];
+    if (mth >= threshold)
+    {
+      threshold = mth;
+      ties = params.max_candidates - above;
+    }
+  }
+  if (threshold == 0 && ties == n) return candidates;
+
+  size_t greater = 0, equal = 0, below_max = 0;
+  #pragma omp parallel for schedule(static) reduction(+:greater,equal) reduction(max:below_max)
+  for (size_t i = 0; i < n; i++)
+  {
+    size_t v = score_vector[i];
+    if (v > threshold) greater++;
+    else if (v == threshold) equal++;
+    else below_max = std::max(below_max, v);
+  }
+
+  candidates.all = false;
+  candidates.size = greater + std::min(equal, ties);
+  candidates.pruned_max = (equal > ties) ? threshold : below_max;
+  candidates.positions.resize(candidates.size);
+  for (size_t i = 0, slot = 0; slot < candidates.size; i++)
+  {
+    if (score_vector[i] > threshold || (score_vector[i] == threshold && ties > 0))
+    {
+      if (score_vector[i] == threshold) ties--;
+      candidates.positions[slot++] = i;
+    }
+  }
+  LOG_INFO("Kept " << candidates.size << " of " << n << " positions as candidates\n");
+  return candidates;
+}
+
+// Scores the candidate positions into a priority queue of type heap_t,
+// then greedily selects windows by score until the reference reaches the
+// largest budget, writing out the reference as it first reaches each
+// smaller one; since the reference only grows, each is what a run with
+// that budget alone would give.
+template<class heap_t, typename index_t, typename sum_t>
+void build_reference(const candidate_set<index_t>& candidates, sdsl::bit_vector& bv, const std::vector<sum_t>& height_sums, unsigned char* text, const std::vector<long>& file_starts, const selection_params& params)
+{
+  const size_t window = params.k;
+
+  /*
+  This snippet initializes the data structures for construction of the
+  reference:
+
+  1. peek their recorded positions on the bit vector
+  2. score them based on [sum(h(i), k) / recorded_positions]
+  3. add the positions, scored, to a heap
+
+  The scores go straight into the heap entries, so that no other array
+  of n scores is held next to the heap.
+
+  */
+  LOG_INFO("Running snippet 1... ");
+  if (params.stats) params.stats->start("scoring");
+  clock_t timestamp = clock();
+  long double wtimestamp = wclock();
+  heap_t pq(candidates.size);
+  #pragma omp parallel for schedule(static)
+  for(size_t i = 0; i < candidates.size; i++)
+  {
+    record_pos rp = peek_record_positions(candidates.position(i), bv, height_sums, file_starts, window);
+    pq.set(i, rp.sum_height / std::max(1UL, rp.already_seen_positions));
+  }
+  LOG_INFO(welapsed(wtimestamp) << "s wallclock (" << elapsed(timestamp) << "s CPU)\n");
+
+  LOG_INFO("Building the heap... ");
+  if (params.stats) params.stats->start("heap_build");
+  timestamp = clock();
+  wtimestamp = wclock();
+  pq.build();
+  LOG_INFO(welapsed(wtimestamp) << "s wallclock (" << elapsed(timestamp) << "s CPU)\n");
+  if (params.stats) params.stats->start("greedy");
+  long heap_operations = 0;
+  size_t n = bv.size();
+  sdsl::bit_vector stale(params.lazy ? pq.size() : 0, 0);
+  bool warned = candidates.all;
+
+  /*
+  This snippet fills the reference.
+
+  1. pop max element
+  2. add max element to the reference
+  3. find new scores of neighborhood
+  4. update the neighborhood scores in the heap
+  5. do 1,2,3 & 4 until it fills a reference sized budget, for every budget
+
+  In lazy mode, 3 and 4 only mark the neighbourhood stale, and a stale
+  position is rescored when it reaches the top of the heap in 1.
+
+  */
+  LOG_INFO("Size of Heap: " << pq.size() << "\n");
+  LOG_INFO("Running snippet 2... \n");
+  // Windows may overshoot the budget by up to one window, and the
+  // reference never holds more than the n symbols of the text.
+  std::string reference;
+  reference.reserve(std::min(params.budgets.back(), n) + window);
+  reference_stream out(params);
+  long windows = 0;
+  size_t checkpoint = 0;
+  while(checkpoint < params.budgets.size())
+  {
+    if (reference.size() >= params.budgets[checkpoint] || pq.empty())
+    {
+      if (!warned && reference.size() < params.budgets[checkpoint])
+      {
+        std::cerr << "Warning: all candidates were selected before reaching the budget\n";
+        warned = true;
+      }
+      if (params.stats) params.stats->start("write_reference");
+      if (checkpoint + 1 == params.budgets.size() && out.is_open()) out.finish(reference, windows);
+      else write_reference(params, params.budgets[checkpoint], reference);
+      if (params.rlz)
+      {
+        if (params.stats) params.stats->start("rlz");
+        compress_with_reference(params, params.budgets[checkpoint], reference, text, n);
+      }
+      if (params.stats) params.stats->start("greedy");
+      checkpoint++;
+      continue;
+    }
+
+    LOG_TRACE("Finding current best candidate...\n");
+    if (params.lazy)
+    {
+      // Scores only decrease, so a stale score is an upper bound and a
+      // fresh one at the top is the true maximum.
+      while (stale[pq.top()])
+      {
+        size_t top = pq.top();
+        stale[top] = 0;
+        pq.update(top, score(candidates.position(top), bv, height_sums, file_starts, window));
+        heap_operations++;
+      }
+    }
+    size_t candidate = candidates.position(pq.extract_max()); //1
+    size_t candidate_score = score(candidate, bv, height_sums, file_starts, window);
+    if (!warned && candidate_score <= candidates.pruned_max)
+    {
+      std::cerr << "Warning: the selection reached the scores of the positions left out of the\n"
+        << "queue, the reference may differ from a run with all positions\n";
+      warned = true;
+    }
+    LOG_TRACE("Adding best candidate to the reference...\n");
+    size_t offset = reference.size();
+    append_window(candidate, bv, text, file_starts, window, reference); //2
+    out.append(reference, offset, candidate, candidate_score);
+    windows++;
+    size_t start, end;
+    LOG_TRACE("Finding new scores of neighborhood and updating heap...\n");
+    window_bounds(candidate, file_starts, window, start, end);
+    // Every window overlapping [start, end) may have gained selected positions.
+    start = candidates.slot((start > window / 2) ? start - window / 2 : 0);
+    end = candidates.slot(std::min(end + window / 2, n));
+    if (params.lazy)
+    {
+      for (size_t i = start; i < end; i++)
+        stale[i] = 1;
+    }
+    else
+    {
+      for (size_t i = start; i < end; i++)
+      {
+        size_t new_score = score(candidates.position(i), bv, height_sums, file_starts, window);
+        pq.update(i, new_score);
+      }
+      heap_operations += end - start;
+    }
+    heap_operations++;
+
+  }
+  if (params.stats)
+  {
+    params.stats->stop();
+    params.stats->add("heap_operations", heap_operations);
+  }
+}
+
+// Picks the candidate positions and runs the greedy selection with queues
+// over index_t.
+template<typename index_t, typename sum_t>
+void run_selection(sdsl::bit_vector& bv, const std::vector<sum_t>& height_sums, unsigned char* text, const std::vector<long>& file_starts, const selection_params& params)
+{
+  candidate_set<index_t> candidates = select_candidates<index_t, sum_t>(bv, height_sums, file_starts, params);
+  if (params.queue == BUCKET_QUEUE)
+    build_reference<BucketQueue<index_t>, index_t, sum_t>(candidates, bv, height_sums, text, file_starts, params);
+  else build_reference<IndexedHeap<index_t>, index_t, sum_t>(candidates, bv, height_sums, text, file_starts, params);
+}
+
+template<typename sum_t>
+void select_reference(sdsl::bit_vector& bv, const std::vector<sum_t>& height_sums, unsigned char* text, const std::vector<long>& file_starts, const selection_params& params)
+{
+  // Positions fit in 32 bits (scores saturate) unless the text is 4GiB or more.
+  if (bv.size() < UINT32_MAX)
+    run_selection<uint32_t, sum_t>(bv, height_sums, text, file_starts, params);
+  else run_selection<uint64_t, sum_t>(bv, height_sums, text, file_starts, params);
+}
+
+// Runs select_reference on the prefix sums of heights, released as soon
+// as the sums are built. They fit in 32 bits unless the text is 4GiB or
+// more. count_t is the ref_count_t of the parse.
+template<typename count_t>
+void select_reference_from_heights(sdsl::bit_vector& bv, std::vector<count_t>& heights, unsigned char* text, const std::vector<long>& file_starts, const selection_params& params)
+{
+  if (heights.size() < UINT32_MAX)
+  {
+    std::vector<uint32_t> height_sums = prefix_sums<uint32_t>(heights);
+    std::vector<count_t>().swap(heights);
+    select_reference(bv, height_sums, text, file_starts, params);
+  }
+  else
+  {
+    std::vector<uint64_t> height_sums = prefix_sums<uint64_t>(heights);
+    std::vector<count_t>().swap(heights);
+    select_reference(bv, height_sums, text, file_starts, params);
+  }
+}
+
+#endif // __SELECTION_H
@@ -0,0 +1,251 @@
+////////////////////////////////////////////////////////////////////////////////
+// bench.cpp
+//   Times every stage of the reference construction on generated inputs.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+#include "../include/common.h"
+#include "../include/kkp.h"
+#include "../include/selection.h"
+#include "../include/metrics.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+void usage(const char *prog)
+{
+  cerr << "usage: " << prog << " [options]\n\n"
+    << "Times SA construction, kkp2, the prefix sums of the counts, initial\n"
+    << "scoring, heap construction and the greedy loop on generated random\n"
+    << "and repetitive texts, writing one CSV line per run. Inputs are\n"
+    << "generated from fixed seeds, so runs are repeatable.\n"
+    << "  --sizes N[,N...]    input sizes, with an optional K, M or G suffix\n"
+    << "                      (default: 1M,4M,16M,64M)\n"
+    << "  --kinds LIST        comma-separated, of random and repetitive\n"
+    << "                      (default: both)\n"
+    << "  --queues LIST       comma-separated, of heap and bucket: the priority\n"
+    << "                      queues to run the selection with (default: heap)\n"
+    << "  --threads N[,N...]  thread counts to run each input with\n"
+    << "                      (default: all cores)\n"
+    << "  --reps R            runs per input and thread count (default: 3)\n"
+    << "  --dictionary-size N reference size (default: 64K)\n"
+    << "  --kmer-size K       window length (default: 16)\n"
+    << "  --lazy              run the lazy greedy selection\n"
+    << "  --candidates M      queue only the M best-scoring positions\n"
+    << "  --csv FILE          write the CSV to FILE instead of stdout\n"
+    << "  --verbose           keep the progress messages of the stages\n";
+  exit(EXIT_FAILURE);
+}
+
+// Fills text with n symbols over ACGT. A random text is uniform, a
+// repetitive one starts with 64KiB of random symbols followed by copies of
+// earlier substrings with a random edit every 1000 symbols on average (see
+// generate_text in common.h), so it is repetitive at every size from 1M up.
+void generate_input(const string& kind, size_t n, vector<unsigned char>& text)
+{
+  mt19937_64 rng(n * 2 + (kind == "repetitive"));
+  text.resize(n);
+  long seed = (kind == "repetitive") ? 1L << 16 : n;
+  generate_text(rng, &text[0], n, seed, 1000);
+}
+
+// Runs all stages on text, recording them in stats.
+template<typename saidx_t>
+void run_stages(vector<unsigned char>& text, const selection_params& params, metrics& stats)
+{
+  long n = text.size();
+  unsigned char *X = &text[0];
+
+  stats.start("suffix_array");
+  saidx_t *sa = new saidx_t[n];
+  construct_sa(X, sa, n);
+
+  stats.start("parse");
+  vector<ref_count_t<saidx_t> > heights(n, 0);
+  stats.add("phrases", kkp2<saidx_t>(X, sa, n, NULL, heights));
+  delete[] sa;
+
+  stats.start("prefix_sums");
+  sdsl::bit_vector bv(n, 0);
+  vector<long> file_starts;
+  file_starts.push_back(0);
+  file_starts.push_back(n + 1);
+  // Windows are at most as long as the text.
+  selection_params run_params = params;
+  run_params.k = min(params.k, (size_t)max(n, 1L));
+  run_params.stats = &stats;
+  select_reference_from_heights(bv, heights, X, file_starts, run_params);
+}
+
+// Splits a comma-separated list of words into items, which must all be
+// in allowed.
+bool parse_list(const char *arg, vector<string>& items, const vector<string>& allowed)
+{
+  string s(arg);
+  for (size_t start = 0; start <= s.size(); )
+  {
+    size_t end = s.find(',', start);
+    if (end == string::npos) end = s.size();
+    items.push_back(s.substr(start, end - start));
+    if (find(allowed.begin(), allowed.end(), items.back()) == allowed.end()) return false;
+    start = end + 1;
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  vector<size_t> sizes, threads, budget;
+  vector<string> kinds, queues;
+  size_t reps = 3;
+  bool verbose = false;
+  const char *csv = NULL;
+  selection_params params;
+  params.k = 16;
+  params.output_prefix = NULL;  // time the selection, write no reference
+  params.rlz = false;
+  params.lazy = false;
+  params.min_score = 0;
+  params.max_candidates = 0;
+  for (int arg = 1; arg < argc; arg++)
+  {
+    if (!strcmp(argv[arg], "--sizes") && arg + 1 < argc)
+    {
+      if (!parse_sizes(argv[++arg], sizes)) usage(argv[0]);
+    }
+    else if (!strcmp(argv[arg], "--kinds") && arg + 1 < argc)
+    {
+      if (!parse_list(argv[++arg], kinds, { "random", "repetitive" })) usage(argv[0]);
+    }
+    else if (!strcmp(argv[arg], "--queues") && arg + 1 < argc)
+    {
+      if (!parse_list(argv[++arg], queues, { "heap", "bucket" })) usage(argv[0]);
+    }
+    else if (!strcmp(argv[arg], "--threads") && arg + 1 < argc)
+    {
+      if (!parse_sizes(argv[++arg], threads)) usage(argv[0]);
+    }
+    else if (!strcmp(argv[arg], "--reps") && arg + 1 < argc)
+    {
+      reps = atol(argv[++arg]);
+      if (reps == 0) usage(argv[0]);
+    }
+    else if (!strcmp(argv[arg], "--dictionary-size") && arg + 1 < argc)
+    {
+      if (!parse_sizes(argv[++arg], budget) || budget.size() != 1) usage(argv[0]);
+    }
+    else if (!strcmp(argv[arg], "--kmer-size") && arg + 1 < argc)
+    {
+      params.k = atol(argv[++arg]);
+      if (params.k == 0) usage(argv[0]);
+    }
+    else if (!strcmp(argv[arg], "--csv") && arg + 1 < argc)
+    {
+      csv = argv[++arg];
+    }
+    else if (!strcmp(argv[arg], "--candidates") && arg + 1 < argc)
+    {
+      vector<size_t> m;
+      if (!parse_sizes(argv[++arg], m) || m.size() != 1) usage(argv[0]);
+      params.max_candidates = m[0];
+    }
+    else if (!strcmp(argv[arg], "--lazy"))
+    {
+      params.lazy = true;
+    }
+    else if (!strcmp(argv[arg], "--verbose"))
+    {
+      verbose = true;
+    }
+    else usage(argv[0]);
+  }
+  if (sizes.empty())
+  {
+    for (size_t size = 1 << 20; size <= (64 << 20); size <<= 2) sizes.push_back(size);
+  }
+  if (kinds.empty())
+  {
+    kinds.push_back("random");
+    kinds.push_back("repetitive");
+  }
+  if (queues.empty())
+  {
+    queues.push_back("heap");
+  }
+  if (threads.empty())
+  {
+#ifdef _OPENMP
+    threads.push_back(omp_get_max_threads());
+#else
+    threads.push_back(1);
+#endif
+  }
+  params.budgets.push_back(budget.empty() ? 64 << 10 : budget[0]);
+
+  ofstream csv_file;
+  if (csv)
+  {
+    csv_file.open(csv);
+    if (!csv_file)
+    {
+      cerr << "Error: cannot write " << csv << "\n";
+      exit(EXIT_FAILURE);
+    }
+  }
+  ostream& out = csv ? csv_file : cout;
+  const char *stages[] = { "suffix_array", "parse", "prefix_sums", "scoring", "heap_build", "greedy" };
+  out << "kind,size,queue,threads,rep,phrases,sa_s,kkp2_s,prefix_sums_s,scoring_s,heap_build_s,greedy_s,total_s,peak_rss_kb" << endl;
+
+  vector<unsigned char> text;
+  for (const string& kind : kinds)
+  {
+    for (size_t size : sizes)
+    {
+      generate_input(kind, size, text);
+      for (size_t t = 0; t < threads.size() * queues.size(); t++)
+      {
+        const string& queue = queues[t % queues.size()];
+        size_t nthreads = threads[t / queues.size()];
+        params.queue = (queue == "bucket") ? BUCKET_QUEUE : INDEXED_HEAP;
+#ifdef _OPENMP
+        omp_set_num_threads(nthreads);
+#endif
+        for (size_t rep = 0; rep < reps; rep++)
+        {
+          // The stages report their progress on cerr; silence it unless asked.
+          if (!verbose) cerr.setstate(ios::badbit);
+          metrics stats;
+          if (size >= (size_t)SA64_THRESHOLD) run_stages<long>(text, params, stats);
+          else run_stages<int>(text, params, stats);
+          cerr.clear();
+
+          long double total = 0;
+          long peak_rss = 0;
+          out << kind << "," << size << "," << queue << "," << nthreads << "," << rep << "," << stats.counter("phrases");
+          for (const char *name : stages)
+          {
+            const metrics::stage *s = stats.find(name);
+            out << "," << s->wall;
+            total += s->wall;
+            peak_rss = max(peak_rss, s->peak_rss);
+          }
+          out << "," << total << "," << peak_rss << endl;
+          cerr << kind << " " << size << " bytes, " << queue << ", " << nthreads << " threads, run "
+            << rep + 1 << "/" << reps << ": " << total << "s\n";
+        }
+      }
+    }
+  }
+  return 0;
+}
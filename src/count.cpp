@@ -35,334 +35,288 @@
 
 
 #include <iostream>
+#include <fstream>
 #include <cstdlib>
 #include <ctime>
 #include <stdio.h>
 #include <cstring>
+#include <cstdint>
 #include "../include/kkp.h"
 #include "../include/common.h"
-#include <queue>
+#include "../include/rlz.h"
+#include "../include/selection.h"
+#include "../include/metrics.h"
 #include <algorithm>
 #include <sdsl/bit_vectors.hpp>
-#include <map>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 
 using namespace std;
 using namespace sdsl;
 
+// Defaults for --dictionary-size and --kmer-size.
 #define DICTIONARY_SIZE 30
 #define KMER_SIZE 16
 
-class HashHeap {
-  private:
-      vector<size_t> heap;
-      vector<size_t> pos_to_idx;
-      vector<size_t> scores;
-      size_t n;
-      
-      void heapify_up(size_t idx) {
-          while (idx > 0) {
-              size_t parent = (idx - 1) / 2;
-              if (scores[heap[idx]] <= scores[heap[parent]])
-                  break;
-              swap(heap[idx], heap[parent]);
-              pos_to_idx[heap[idx]] = idx;
-              pos_to_idx[heap[parent]] = parent;
-              idx = parent;
-          }
-      }
-      
-      void heapify_down(size_t idx) {
-          size_t heap_size = heap.size();
-          while (true) {
-              size_t largest = idx;
-              size_t left = 2 * idx + 1;
-              size_t right = 2 * idx + 2;
-              
-              if (left < heap_size && scores[heap[left]] > scores[heap[largest]])
-                  largest = left;
-              if (right < heap_size && scores[heap[right]] > scores[heap[largest]])
-                  largest = right;
-                  
-              if (largest == idx) break;
-              
-              swap(heap[idx], heap[largest]);
-              pos_to_idx[heap[idx]] = idx;
-              pos_to_idx[heap[largest]] = largest;
-              idx = largest;
-          }
-      }
-      
-  public:
-      HashHeap(size_t size, vector<size_t>& initial_scores) : n(size) {
-          pos_to_idx.resize(n, n);
-          scores = initial_scores;
-          heap.reserve(n);
-          
-          for (size_t i = 0; i < n; i++) {
-              heap.push_back(i);
-              pos_to_idx[i] = i;
-          }
-          
-          for (int i = n/2 - 1; i >= 0; i--) {
-              heapify_down(i);
-          }
-      }
-      
-      void update(size_t pos, size_t new_score) {
-          if (pos >= n) return;
-          scores[pos] = new_score;
-          size_t idx = pos_to_idx[pos];
-          if (idx < heap.size()) {
-              heapify_up(idx);
-              heapify_down(idx);
-          }
-      }
-      
-      size_t extract_max() {
-          size_t max_pos = heap[0];
-          heap[0] = heap.back();
-          pos_to_idx[heap[0]] = 0;
-          heap.pop_back();
-          pos_to_idx[max_pos] = n;
-          if (!heap.empty()) heapify_down(0);
-          return max_pos;
-      }
-      
-      bool empty() {
-          return heap.empty();
-      }
-      
-      size_t size() {
-          return heap.size();
-      }
-  };
-
-void print_debug(const vector<pair<size_t,size_t>>& heights, const bit_vector& bv, unsigned char *text)
+// Parses the text with kkp2 and fills heights. The suffix array is mapped
+// from filename.sa if cached_sa is set (saidx_t then matches the width of
+// its entries), otherwise it is computed in memory. With semi_external the
+// cached suffix array is instead streamed from disk by kkp1. parallel_parse
+// is passed on to kkp2. The stages suffix_array and parse go to stats.
+template<typename saidx_t>
+void compute_heights(const char *filename, unsigned char *text, long length, bool cached_sa, bool semi_external, bool parallel_parse, vector<ref_count_t<saidx_t> >& heights, metrics& stats)
 {
+  if (semi_external)
+  {
+    LOG_INFO("Running algorithm kkp1...\n");
+    stats.start("parse");
+    stats.add("phrases", kkp1<saidx_t>(text, string(filename) + ".sa", length, NULL, heights));
+    stats.add("bytes_read", sizeof(saidx_t) * length);
+    return;
+  }
 
-  for(pair<size_t, size_t> i : heights) cerr << i.first << ", ";
-  cerr << "\n";
-  for(pair<size_t, size_t> i : heights) cerr << i.second << ", ";
-  cerr << "\n";
-  for(pair<size_t, size_t> i : heights) cerr << text[i.second] << ", ";
-  cerr << "\n";
-  for(auto i : bv) cerr << i << ", ";
-  cerr << "\n";
-
+  stats.start("suffix_array");
+  saidx_t *sa = NULL;
+  if (cached_sa)
+  {
+    map_sa(filename, sa, length);
+    stats.add("bytes_read", sizeof(saidx_t) * length);
+  }
+  else
+  {
+    sa = new saidx_t[length];
+    LOG_INFO("Computing suffix array... ");
+    long double wts = wclock();
+    construct_sa(text, sa, length);
+    LOG_INFO(welapsed(wts) << "s\n");
+  }
+  LOG_INFO("Running algorithm kkp2...\n");
+  stats.start("parse");
+  stats.add("phrases", kkp2<saidx_t>(text, sa, length, NULL, heights, parallel_parse));
+  if (cached_sa) unmap_file(sa, sizeof(saidx_t) * length);
+  else delete[] sa;
 }
 
-struct record_pos
+// Parses the text and builds the references from the heights, whose width
+// follows the suffix array (see ref_count_t).
+template<typename saidx_t>
+void parse_and_select(const char *filename, unsigned char *text, long length, bool cached_sa, bool semi_external, bool parallel_parse, const vector<long>& file_starts, const selection_params& params, metrics& stats)
 {
-  size_t sum_height = 0;
-  size_t already_seen_positions = 1;
-};
+  vector<ref_count_t<saidx_t> > heights(length, 0);
+  compute_heights<saidx_t>(filename, text, length, cached_sa, semi_external, parallel_parse, heights, stats);
 
+  stats.start("prefix_sums");
+  bit_vector bv(length, 0); // creates bitvector for currently selected positions
+  select_reference_from_heights(bv, heights, text, file_starts, params);
+}
 
-record_pos peek_record_positions(size_t middle_pos, const bit_vector& bv, const vector<pair<size_t, size_t>>& heights, size_t k = KMER_SIZE)
+void usage(const char *prog)
 {
-    record_pos recorded_positions; 
-    size_t start;
-    if (middle_pos > k / 2)
+  cerr << "usage: " << prog << " [options] infile\n\n"
+    << "Builds an RLZ reference for infile from its LZ77 parsing. If infile\n"
+    << "is a directory, one reference is built for all of its files, and no\n"
+    << "window selected for it spans two files.\n"
+    << "  --threads N      number of threads for SA construction, initial\n"
+    << "                   scoring and heap construction (default: all cores)\n"
+    << "  --semi-external  stream infile.sa from disk during parsing instead\n"
+    << "                   of holding the suffix array in memory\n"
+    << "  --parallel-parse compute the longest previous factor of every position\n"
+    << "                   in parallel and only jump between phrases\n"
+    << "                   sequentially (same parsing, faster with many threads)\n"
+    << "  --metrics FILE   write the time, CPU time and peak memory of every\n"
+    << "                   stage and the I/O and work counters to FILE as\n"
+    << "                   JSON (- for standard output)\n"
+    << "  --dictionary-size N[,N...]  target reference size in bytes, with an\n"
+    << "                   optional K, M or G suffix (default: "
+    << DICTIONARY_SIZE << "). With\n"
+    << "                   several sizes the selection runs once and writes a\n"
+    << "                   reference for each\n"
+    << "  --output PREFIX  write the reference for size N to PREFIX.N\n"
+    << "                   (default: infile.ref).\n"
+    << "                   The largest reference is written as it is built,\n"
+    << "                   along with PREFIX.N.pos, which holds the centre,\n"
+    << "                   score and reference offset of every selected window\n"
+    << "                   as three longs\n"
+    << "  --rlz            RLZ-compress infile against each reference, writing\n"
+    << "                   the reference PREFIX.N and PREFIX.N.rlz next to it\n"
+    << "  --queue heap|bucket  priority queue of the greedy selection: an\n"
+    << "                   indexed 4-ary heap (default) or a monotone bucket\n"
+    << "                   queue with O(1) updates; the reference is the same\n"
+    << "  --lazy           rescore a position only when it reaches the top of\n"
+    << "                   the queue instead of after every nearby selection;\n"
+    << "                   the reference is the same\n"
+    << "  --min-score S    only positions with an initial score of at least S\n"
+    << "                   are candidates for the reference\n"
+    << "  --candidates M   only the M best-scoring positions (K, M or G suffix\n"
+    << "                   allowed) are candidates. With either option the\n"
+    << "                   queue is sized to the candidates, and a warning is\n"
+    << "                   printed if the result may differ from a full run\n"
+    << "  --kmer-size K    length of the windows added to the reference, at\n"
+    << "                   most the input length. A window has (K - 1) / 2\n"
+    << "                   symbols on each side of its centre for odd K, and\n"
+    << "                   K / 2 on the left and K / 2 - 1 on the right for\n"
+    << "                   even K\n"
+    << "                   (default: " << KMER_SIZE << ")\n";
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+
+  int threads = 0, arg = 1;
+  bool semi_external = false, parallel_parse = false;
+  selection_params params;
+  params.k = KMER_SIZE;
+  params.queue = INDEXED_HEAP;
+  params.lazy = false;
+  params.min_score = 0;
+  params.max_candidates = 0;
+  params.output_prefix = NULL;
+  params.rlz = false;
+  const char *metrics_file = NULL;
+  metrics stats;
+  params.stats = &stats;
+  string default_prefix;
+  for (; arg < argc && !strncmp(argv[arg], "--", 2); arg++)
+  {
+    if (!strcmp(argv[arg], "--threads") && arg + 1 < argc)
     {
-        start = middle_pos - k / 2;
+      threads = atoi(argv[++arg]);
+      if (threads <= 0) usage(argv[0]);
     }
-    else
+    else if (!strcmp(argv[arg], "--semi-external"))
     {
-        start = 0;
+      semi_external = true;
     }
-    
-    size_t end = middle_pos + k / 2;
-    if (end > bv.size())
+    else if (!strcmp(argv[arg], "--metrics") && arg + 1 < argc)
     {
-        end = bv.size();
+      metrics_file = argv[++arg];
     }
-    
-    for (size_t i = start; i < end; i++)
+    else if (!strcmp(argv[arg], "--queue") && arg + 1 < argc)
     {
-        //bv[i] = 1;
-
-        recorded_positions.sum_height += heights[i].first;
-        if(bv[i] == 1)
-        {
-          recorded_positions.already_seen_positions++;
-        }
+      arg++;
+      if (!strcmp(argv[arg], "heap")) params.queue = INDEXED_HEAP;
+      else if (!strcmp(argv[arg], "bucket")) params.queue = BUCKET_QUEUE;
+      else usage(argv[0]);
     }
-
-    return recorded_positions;
-}
-
-string candidate_string(size_t candidate, bit_vector& bv, unsigned char* text, size_t k = KMER_SIZE)
-{
-    size_t start;
-    string c = "";
-    if (candidate > k / 2)
+    else if (!strcmp(argv[arg], "--min-score") && arg + 1 < argc)
     {
-        start = candidate - k / 2;
+      params.min_score = strtoul(argv[++arg], NULL, 10);
     }
-    else
+    else if (!strcmp(argv[arg], "--candidates") && arg + 1 < argc)
     {
-        start = 0;
+      vector<size_t> m;
+      if (!parse_sizes(argv[++arg], m) || m.size() != 1) usage(argv[0]);
+      params.max_candidates = m[0];
     }
-    
-    size_t end = candidate + k / 2;
-    if (end > bv.size())
+    else if (!strcmp(argv[arg], "--lazy"))
     {
-        end = bv.size();
+      params.lazy = true;
     }
-    
-    for (size_t i = start; i < end; i++)
+    else if (!strcmp(argv[arg], "--parallel-parse"))
     {
-      if(bv[i] != 1)
-      c += text[i];
-
-      bv[i] = 1;
-      
+      parallel_parse = true;
     }
-    cerr << "Candidate string: " << c << "\n";
-    return c;
-}
-
-size_t score(size_t candidate, bit_vector& bv, const vector<pair<size_t, size_t>>& heights, size_t k = KMER_SIZE)
-{
-    size_t sum = 0;
-    size_t denom = 0;
-    size_t start;
-    if (candidate > k / 2)
+    else if (!strcmp(argv[arg], "--dictionary-size") && arg + 1 < argc)
     {
-        start = candidate - k / 2;
+      if (!parse_sizes(argv[++arg], params.budgets)) usage(argv[0]);
     }
-    else
+    else if (!strcmp(argv[arg], "--kmer-size") && arg + 1 < argc)
     {
-        start = 0;
+      params.k = strtoul(argv[++arg], NULL, 10);
+      if (params.k == 0) usage(argv[0]);
     }
-    
-    size_t end = candidate + k / 2;
-    if (end > bv.size())
+    else if (!strcmp(argv[arg], "--output") && arg + 1 < argc)
     {
-        end = bv.size();
+      params.output_prefix = argv[++arg];
     }
-    
-    for (size_t i = start; i < end; i++)
+    else if (!strcmp(argv[arg], "--rlz"))
     {
-      sum += heights[i].first;
-      if(bv[i] == 1)
-      {
-       denom++; 
-      }
+      params.rlz = true;
     }
-    return sum / max(1UL, denom);
-}
-
-int main(int argc, char **argv)
-{
-
-  if (argc != 2)
+    else usage(argv[0]);
+  }
+  if (argc - arg != 1)
+  {
+    usage(argv[0]);
+  }
+  // Names derived from infile go next to a directory, not into it.
+  string input = input_name(argv[arg]);
+  const char *infile = input.c_str();
+  if (params.budgets.empty())
+  {
+    params.budgets.push_back(DICTIONARY_SIZE);
+  }
+  sort(params.budgets.begin(), params.budgets.end());
+  params.budgets.erase(unique(params.budgets.begin(), params.budgets.end()), params.budgets.end());
+  // The references always go to files, standard error only gets progress.
+  if (!params.output_prefix)
   {
-    exit(EXIT_FAILURE);
+    default_prefix = string(infile) + ".ref";
+    params.output_prefix = default_prefix.c_str();
   }
 
-  unsigned char *text;
-  int *sa = NULL, length;
-  read_text(argv[1], text, length);
+#ifdef _OPENMP
+  if (threads > 0) omp_set_num_threads(threads);
+  LOG_INFO("Using " << omp_get_max_threads() << " threads\n");
+#else
+  if (threads > 1)
+    cerr << "Warning: built without OpenMP, --threads is ignored\n";
+#endif
 
-  clock_t timestamp;
-  long double wtimestamp;
-
-  wtimestamp = wclock();
-  read_sa(argv[1], sa, length);
-  cerr << "Running algorithm kkp2...\n";
-  timestamp = clock();
-  size_t n = strlen((const char*)text) - 1;
-  vector<pair<size_t,size_t>> heights;
-  heights.reserve(n);                    
-  for (size_t i = 0; i < n; ++i)
+  // A directory is read as a collection of files.
+  unsigned char *text;
+  long length;
+  vector<long> file_starts;
+  stats.start("read_input");
+  map_input(infile, text, length, file_starts);
+  stats.add("bytes_read", length);
+  if (params.k > (size_t)max(length, 1L))
   {
-      heights.emplace_back(0, i);
+    cerr << "Warning: --kmer-size " << params.k << " exceeds the input length, using " << max(length, 1L) << "\n";
+    params.k = max(length, 1L);
   }
-  
-  kkp2(text, sa, length, NULL, heights); // creates height vector
-
-  bit_vector bv(n, 0); // creates bitvector for currently selected positions
-  
-  
-  /*
-  This snippet initializes the data structures for construction of the
-  reference: 
-  
-  1. peek their recorded positions on the bit vector
-  2. score them based on [sum(h(i), k) / recorded_positions]
-  3. add the positions, scored, to a heap  
-  
-  */
-  cerr << "Running snippet 1... \n";
-  vector<size_t> score_vector(n, 0);
-  for(size_t i = 0; i < heights.size(); i++)
+  if (parallel_parse && (semi_external || kkp2_blocks(length) < 2))
   {
-    record_pos rp = peek_record_positions(heights[i].second, bv, heights);
-    int score = rp.sum_height / max(1UL, rp.already_seen_positions);
-    score_vector[i] = score;
+    cerr << "Warning: --parallel-parse has no effect ";
+    if (semi_external) cerr << "with --semi-external\n";
+    else cerr << "with one thread or on inputs under " << (2L << ANSV_BLOCK_BITS) << " bytes\n";
   }
 
-  HashHeap pq(n, score_vector);
-  
-  /*
-  This snippet fills the reference.
-
-  1. pop max element
-  2. add max element to the reference
-  3. find new scores of neighborhood
-  4. update the neighborhood scores in the HashHeap
-  5. do 1,2,3 & 4 until it fills a reference sized DICTIONARY_SIZE
+  clock_t timestamp;
+  long double wtimestamp;
 
-  */
-  cerr << "Size of Heap: " << pq.size() << "\n";
-  cerr << "Running snippet 2... \n";
-  string reference = "";
-  while(reference.size() < DICTIONARY_SIZE && ! pq.empty())
+  wtimestamp = wclock();
+  timestamp = clock();
+  // creates height vector, building the SA in memory if there is no
+  // infile.sa to reuse
+  int width = sa_width(infile, length);
+  bool cached_sa = (width != 0);
+  if (!cached_sa)
   {
-    cerr << "Finding current best candidate...\n";
-    size_t candidate = pq.extract_max(); //1
-    cerr << "Adding best candidate to the reference...\n";
-    reference += candidate_string(candidate, bv, text); //2
-    size_t start;
-    cerr << "Finding new scores of neighborhood and updating hashheap...\n";
-    if (candidate > KMER_SIZE / 2)
-    {
-        start = candidate - KMER_SIZE / 2;
-    }
-    else
-    {
-        start = 0;
-    }
-    
-    size_t end = candidate + KMER_SIZE / 2;
-    if (end > bv.size())
+    if (semi_external)
     {
-        end = bv.size();
+      cerr << "\nError: --semi-external needs " << infile << ".sa, run gensa first\n";
+      exit(EXIT_FAILURE);
     }
-    for (size_t i = start; i < end; i++)
-    {
-      size_t new_score = score(i, bv, heights);
-      pq.update(i, new_score);
-    }
-
+    width = (length >= SA64_THRESHOLD) ? sizeof(long) : sizeof(int);
   }
+  if (width == (int)sizeof(long))
+    parse_and_select<long>(infile, text, length, cached_sa, semi_external, parallel_parse, file_starts, params, stats);
+  else parse_and_select<int>(infile, text, length, cached_sa, semi_external, parallel_parse, file_starts, params, stats);
 
-  //print_debug(heights, bv, text);
-  cerr << "\nReference: " << reference << " - End of reference.\n";
-  cerr << "\n";
-  cerr << "CPU time: " << elapsed(timestamp) << "s\n";
-  cerr << "Wallclock time including SA reading: " << welapsed(wtimestamp) << "s\n";
-
-
+  LOG_INFO("\n");
+  LOG_INFO("CPU time: " << elapsed(timestamp) << "s\n");
+  LOG_INFO("Wallclock time including SA construction/reading: " << welapsed(wtimestamp) << "s\n");
+  stats.stop();
+  if (metrics_file) stats.write_json(metrics_file, "count");
 
   // Clean up.
-  if (sa) delete[] sa;
-  delete[] text;
+  unmap_file(text, length);
   return EXIT_SUCCESS;
 }
-
-
-//first -> heights
-//second -> indexes
@@ -0,0 +1,100 @@
+////////////////////////////////////////////////////////////////////////////////
+// extract.cpp
+//   Random access to an RLZ-compressed file written by count --rlz.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <random>
+
+#include "../include/common.h"
+#include "../include/rlz.h"
+#include "../include/metrics.h"
+
+using namespace std;
+
+void usage(const char *prog)
+{
+  cerr << "usage: " << prog << " reference rlzfile pos len\n"
+    << "       " << prog << " --bench Q L reference rlzfile\n\n"
+    << "Prints the substring of length len starting at pos of the text\n"
+    << "compressed in rlzfile against reference. With --bench, instead\n"
+    << "times Q random extractions of length L.\n";
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+  long queries = 0, query_len = 0;
+  int arg = 1;
+  if (arg + 2 < argc && !strcmp(argv[arg], "--bench"))
+  {
+    queries = atol(argv[arg + 1]);
+    query_len = atol(argv[arg + 2]);
+    if (queries <= 0 || query_len <= 0) usage(argv[0]);
+    arg += 3;
+  }
+  if (argc - arg != (queries ? 2 : 4))
+  {
+    usage(argv[0]);
+  }
+
+  unsigned char *ref;
+  long ref_length;
+  map_text(argv[arg], ref, ref_length);
+  string reference((const char *)ref, ref_length);
+  unmap_file(ref, ref_length);
+
+  long double wtimestamp = wclock();
+  vector<pair<long, long>> phrases;
+  long n = rlz_read(argv[arg + 1], phrases);
+  rlz_decoder decoder(reference, phrases, n);
+  vector<pair<long, long>>().swap(phrases);
+  LOG_INFO("Loaded " << decoder.phrases() << " phrases of a text of " << n
+    << " bytes in " << welapsed(wtimestamp) << "s, index size "
+    << decoder.size_in_bytes() << " bytes\n");
+
+  if (!queries)
+  {
+    long pos = atol(argv[arg + 2]), len = atol(argv[arg + 3]);
+    if (pos < 0 || len < 0 || pos + len > n)
+    {
+      cerr << "\nError: range [" << pos << ", " << pos + len
+        << ") is outside the text\n";
+      exit(EXIT_FAILURE);
+    }
+    vector<unsigned char> out(len);
+    decoder.extract(pos, len, out.data());
+    cout.write((const char *)out.data(), len);
+    return EXIT_SUCCESS;
+  }
+
+  if (query_len > n)
+  {
+    cerr << "\nError: query length exceeds the text length\n";
+    exit(EXIT_FAILURE);
+  }
+  mt19937_64 rng(1);
+  vector<long> starts(queries);
+  for (long q = 0; q < queries; q++)
+  {
+    starts[q] = rng() % (n - query_len + 1);
+  }
+  vector<unsigned char> out(query_len);
+  unsigned long checksum = 0;
+  wtimestamp = wclock();
+  for (long q = 0; q < queries; q++)
+  {
+    decoder.extract(starts[q], query_len, out.data());
+    checksum += out[query_len - 1];
+  }
+  long double total = welapsed(wtimestamp);
+  cerr << queries << " random extractions of " << query_len << " bytes: "
+    << 1e6 * total / queries << " us per query, "
+    << queries * query_len / total / 1e6 << " MB/s (checksum " << checksum
+    << ")\n";
+  return EXIT_SUCCESS;
+}
@@ -28,46 +28,102 @@
 
 #include <iostream>
 #include <fstream>
+#include <vector>
 
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 
-#include "divsufsort.h"
-#include "common.h"
-
-int main(int argc, char **argv) {
-  if (argc != 3) {
-    std::cerr << "usage: " << argv[0] << " infile outfile           \n\n"
-      << "Computes the suffix array of infile and stores into outfile.\n";
-    std::exit(EXIT_FAILURE);
-  }
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
-  // Read the text.
-  unsigned char *text;
-  int length;
-  read_text(argv[1], text, length);
+#include "common.h"
+#include "metrics.h"
 
-  // Alocate and compute the suffix array.  
-  int *sa = new int[length];
+template<typename saidx_t>
+void compute_and_write_sa(const unsigned char *text, long length,
+    const char *outfname, metrics &stats) {
+  // Alocate and compute the suffix array.
+  saidx_t *sa = new saidx_t[length];
   if (!sa) {
     std::cerr << "\nError: allocating " << length << " words failed\n";
     std::exit(EXIT_FAILURE);
   }
-  std::cerr << "Computing suffix array... ";
+  LOG_INFO("Computing suffix array (" << 8 * sizeof(saidx_t)
+    << "-bit entries)... ");
+  stats.start("suffix_array");
   std::clock_t timestamp = std::clock();
-  divsufsort(text, sa, length);
-  std::cerr << elapsed(timestamp) << " secs\n";
+  long double wtimestamp = wclock();
+  construct_sa(text, sa, length);
+  LOG_INFO(elapsed(timestamp) << " secs CPU, " << welapsed(wtimestamp)
+    << " secs wallclock\n");
 
   // Write the output on standard output.
-  std::cerr << "Writing the output to " << argv[2] << "... ";
-  std::fstream outfile(argv[2], std::fstream::out);
-  outfile.write((char *)sa, sizeof(int) * length);
+  LOG_INFO("Writing the output to " << outfname << "... ");
+  stats.start("write_sa");
+  std::fstream outfile(outfname, std::fstream::out);
+  outfile.write((char *)sa, sizeof(saidx_t) * length);
   outfile.close();
-  std::cerr << std::endl;
+  stats.stop();
+  stats.add("bytes_written", sizeof(saidx_t) * length);
+  LOG_INFO(std::endl);
 
-  // Clean up.
-  delete[] text;
   delete[] sa;
-  return EXIT_SUCCESS;
 }
 
+void usage(const char *prog) {
+  std::cerr << "usage: " << prog << " [--threads N] [--metrics FILE] infile outfile\n\n"
+    << "Computes the suffix array of infile and stores into outfile. If\n"
+    << "infile is a directory, its files are concatenated as a collection.\n"
+    << "  --threads N  number of threads used to sort the type B* suffixes\n"
+    << "               and induce the type B ones from them (default: all\n"
+    << "               available cores)\n"
+    << "  --metrics FILE  write the time, CPU time and peak memory of every\n"
+    << "                  stage and the bytes read and written to FILE as\n"
+    << "                  JSON (- for standard output)\n";
+  std::exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  int threads = 0, arg = 1;
+  const char *metrics_file = NULL;
+  for (; arg + 1 < argc && !strncmp(argv[arg], "--", 2); arg += 2) {
+    if (!strcmp(argv[arg], "--threads")) {
+      threads = std::atoi(argv[arg + 1]);
+      if (threads <= 0) usage(argv[0]);
+    } else if (!strcmp(argv[arg], "--metrics")) {
+      metrics_file = argv[arg + 1];
+    } else usage(argv[0]);
+  }
+  if (argc - arg != 2) usage(argv[0]);
+  const char *infile = argv[arg], *outfile = argv[arg + 1];
+
+#ifdef _OPENMP
+  if (threads > 0) omp_set_num_threads(threads);
+  LOG_INFO("Using " << omp_get_max_threads() << " threads\n");
+#else
+  if (threads > 1)
+    std::cerr << "Warning: built without OpenMP, --threads is ignored\n";
+#endif
+
+  // Read the text, or the concatenation of the files if infile is a
+  // directory.
+  unsigned char *text;
+  long length;
+  std::vector<long> file_starts;
+  metrics stats;
+  stats.start("read_input");
+  map_input(infile, text, length, file_starts);
+  stats.add("bytes_read", length);
+
+  // Texts of 2GiB or more need 64-bit suffix array entries.
+  if (length >= SA64_THRESHOLD)
+    compute_and_write_sa<long>(text, length, outfile, stats);
+  else compute_and_write_sa<int>(text, length, outfile, stats);
+  if (metrics_file) stats.write_json(metrics_file, "gensa");
+
+  // Clean up.
+  unmap_file(text, length);
+  return EXIT_SUCCESS;
+}
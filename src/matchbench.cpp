@@ -0,0 +1,74 @@
+////////////////////////////////////////////////////////////////////////////////
+// matchbench.cpp
+//   Microbenchmark of the match extension kernels of match.h.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <random>
+
+#include "../include/common.h"
+#include "../include/match.h"
+
+using namespace std;
+
+typedef long (*kernel_t)(const unsigned char *, const unsigned char *, long, long);
+
+void usage(const char *prog)
+{
+  cerr << "usage: " << prog << " [n [L]]\n\n"
+    << "Generates a text of n bytes (default 2^26) made of copies of earlier\n"
+    << "text with a random edit every L bytes on average (default 4096), and\n"
+    << "times each match extension kernel on the resulting long phrases.\n";
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+  long n = 1L << 26, phrase_len = 4096;
+  if (argc > 3) usage(argv[0]);
+  if (argc > 1) n = atol(argv[1]);
+  if (argc > 2) phrase_len = atol(argv[2]);
+  if (n <= 0 || phrase_len <= 0) usage(argv[0]);
+
+  // A random seed followed by edited copies of earlier text: phrase i of the
+  // copies starts at starts[i] and its source is sources[i].
+  mt19937_64 rng(1);
+  vector<unsigned char> text(n);
+  vector<long> starts, sources;
+  generate_text(rng, &text[0], n, 1L << 16, phrase_len, &starts, &sources);
+  cerr << n << " bytes, " << starts.size() << " phrases\n";
+
+  vector<pair<string, kernel_t>> kernels;
+  kernels.push_back(make_pair("bytes", &match_length_bytes));
+  kernels.push_back(make_pair("words", &match_length_words));
+#ifdef MATCH_HAVE_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    kernels.push_back(make_pair("avx2", &match_length_avx2));
+#endif
+
+  vector<long> expected;
+  for (auto &kernel : kernels)
+  {
+    vector<long> lengths(starts.size());
+    long double wts = wclock();
+    long total = 0;
+    for (size_t p = 0; p < starts.size(); ++p)
+    {
+      lengths[p] = kernel.second(&text[0] + sources[p], &text[0] + starts[p], 0, n - starts[p]);
+      total += lengths[p];
+    }
+    long double secs = welapsed(wts);
+    if (expected.empty()) expected = lengths;
+    else if (lengths != expected)
+    {
+      cerr << "Error: kernel " << kernel.first << " disagrees with " << kernels[0].first << "\n";
+      return EXIT_FAILURE;
+    }
+    cout << kernel.first << ": " << total << " bytes matched in " << secs << "s ("
+      << total / secs / (1L << 30) << " GiB/s)\n";
+  }
+  return 0;
+}